@@ -71,6 +71,23 @@ struct avl_node {
         struct avl_node *left;
         struct avl_node *right;
         ssize_t height;
+#ifdef AVL_COUNTS
+        unsigned int hits;
+#endif
+#ifdef AVL_MERKLE
+        uint64_t digest;
+        uint64_t merkle;
+#endif
+};
+
+/** AVL Node Flag: Removed from a lazy tree but not yet compacted (in height) */
+#define AVL_DEAD ((ssize_t)1 << (AVL_STACK_MAX / 2))
+
+/** AVL Tree Node with a String Key (allocated by avl_alloc_t) */
+struct avl_str_node {
+        struct avl_node node;
+        uint64_t prefix;
+        size_t length;
 };
 
 /** AVL Node Allocation */
@@ -79,17 +96,130 @@ typedef struct avl_node *(*avl_alloc_t)(void *heap);
 /** AVL Node Free */
 typedef void (*avl_free_t)(void *heap, struct avl_node *node);
 
+/** AVL Node Relocated by avl_defrag (old nodes are kept until the pass ends) */
+typedef void (*avl_moved_t)(
+        void *heap,
+        struct avl_node *from,
+        struct avl_node *to);
+
+/** AVL Removed Node Visitor (takes ownership of the detached node) */
+typedef void (*avl_visit_t)(void *state, struct avl_node *node);
+
 /** AVL Tree Comparison Function */
 typedef int (*avl_cmp_t)(struct avl_kv a, struct avl_kv b);
 
+#ifdef AVL_MERKLE
+/** AVL Entry Digest Function (compiled in with AVL_MERKLE) */
+typedef uint64_t (*avl_digest_t)(struct avl_kv key, struct avl_kv value);
+
+/** AVL Merkle Difference Visitor (a or b is NULL if the key is missing) */
+typedef void (*avl_diff_t)(
+        void *state, 
+        struct avl_node *a, 
+        struct avl_node *b);
+#endif
+
+/** AVL Key Hash Function (equal keys must hash equally) */
+typedef uint64_t (*avl_hash_t)(struct avl_kv key);
+
+/** AVL Tree Mode: Allow duplicate keys in arrival order */
+#define AVL_MULTI 0x1
+
+/** AVL Tree Mode: Removal marks nodes dead until compaction (not MULTI) */
+#define AVL_LAZY 0x2
+
+/** AVL Tree Mode: Weak AVL rank balancing, O(1) amortized delete fixup */
+#define AVL_WAVL 0x4
+
+/** AVL Tree Mode: Nodes are avl_str_nodes (set by avl_str_tree_init) */
+#define AVL_STR 0x10
+
+#ifdef AVL_COUNTS
+/** AVL Tree Mode: avl_get tracks each node's hits for avl_reshape */
+#define AVL_TRACK_HITS 0x8
+#endif
+
+#ifdef AVL_STATS
+/** AVL Tree Operation Counters (compiled in with AVL_STATS) */
+struct avl_stats {
+        size_t compares;
+        size_t rotations;
+        size_t double_rotations;
+        size_t retraces;
+        size_t allocs;
+        size_t frees;
+        size_t failed_adds;
+};
+#endif
+
 /** Balanced Binary Search Tree */
 struct avl_tree {
         struct avl_node *root;
+        struct avl_node *min;
+        struct avl_node *max;
         size_t size;
+        size_t dead;
         avl_cmp_t cmp;
         avl_alloc_t alloc;
         avl_free_t free;
         void *heap;
+        size_t node_size;
+        size_t value_size;
+        unsigned int mode;
+        struct avl_kv defrag_key;
+        struct avl_node *defrag_node;
+        struct avl_node *defrag_old;
+        int defrag;
+        int shaped;
+        avl_hash_t hash;
+        struct avl_node **index;
+        size_t index_size;
+        avl_hash_t filter_hash;
+        uint64_t *filter;
+        size_t filter_blocks;
+        size_t filter_stale;
+        avl_hash_t cache_hash;
+        struct avl_node **cache;
+        size_t cache_size;
+#ifdef AVL_STATS
+        struct avl_stats stats;
+#endif
+#ifdef AVL_MERKLE
+        avl_digest_t digest;
+#endif
+};
+
+#ifndef AVL_MERGE_MAX
+#define AVL_MERGE_MAX 16
+#endif
+
+/** AVL Merge Policy: Yield every entry, equal keys in source order */
+#define AVL_MERGE_ALL 0
+
+/** AVL Merge Policy: Yield only the first source's entry for equal keys */
+#define AVL_MERGE_FIRST 1
+
+/** AVL Merge Policy: Yield only the last source's entry for equal keys */
+#define AVL_MERGE_LAST 2
+
+/** Ordered merge of several positioned avl_stacks */
+struct avl_merge {
+        struct avl_tree *trees[AVL_MERGE_MAX];
+        struct avl_stack *stacks[AVL_MERGE_MAX];
+        struct avl_node *heads[AVL_MERGE_MAX];
+        size_t heap[AVL_MERGE_MAX];
+        size_t count;
+        size_t size;
+        unsigned int policy;
+        int reversed;
+};
+
+/** AVL Tree Shape Report */
+struct avl_report {
+        size_t size;
+        size_t height;
+        size_t bytes;
+        size_t depths[AVL_STACK_MAX];
 };
 
 /** Stack for AVL Trees */
@@ -115,9 +245,65 @@ struct avl_tree *avl_tree_init(
         avl_free_t free,
         void *state);
 
+/** Set the mode flags of an empty avl_tree. */
+struct avl_tree *avl_tree_mode(struct avl_tree *tree, unsigned int mode);
+
+/** Keep value_size bytes inline after each node (alloc returns node_size). */
+struct avl_tree *avl_tree_inline(struct avl_tree *tree, size_t value_size);
+
+#ifdef AVL_STATS
+/** Zero the tree's operation counters. */
+struct avl_tree *avl_stats_reset(struct avl_tree *tree);
+#endif
+
+/** Index keys for avl_get; dropped if NULL, or if an add fails to grow it. */
+struct avl_tree *avl_tree_index(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        avl_hash_t hash);
+
+/** Screen avl_get misses with a blocked Bloom filter, or drop it if NULL. */
+struct avl_tree *avl_tree_filter(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        avl_hash_t hash);
+
+/** Cache avl_get hits in a direct-mapped table, or drop it if NULL. */
+struct avl_tree *avl_tree_cache(
+        struct avl_tree *tree,
+        avl_hash_t hash,
+        size_t slots);
+
+/** Hash u64 keys. */
+uint64_t avl_hash_u64(struct avl_kv key);
+
+/** Measure the tree's height, depth histogram and node memory. */
+struct avl_report *avl_report(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_report *report);
+
+/** Free the dead nodes of a lazy tree and rebuild it balanced. */
+struct avl_tree *avl_compact(struct avl_tree *tree, struct avl_stack *stack);
+
+#ifdef AVL_COUNTS
+/** Rebuild by hits and halve them; the next change runs O(n) avl_compact. */
+struct avl_tree *avl_reshape(struct avl_tree *tree, struct avl_stack *stack);
+#endif
+
+/** Move up to budget nodes into copies allocated up front; 0 when done. */
+int avl_defrag(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        size_t budget,
+        avl_moved_t moved);
+
 /** Free all the tree's nodes. */
 void avl_free_nodes(struct avl_tree *tree, struct avl_stack *stack);
 
+/** Free all the tree's nodes and drop its index, filter and cache. */
+void avl_tree_free(struct avl_tree *tree, struct avl_stack *stack);
+
 /** Add a new entry unless it already exists. */
 struct avl_node *avl_add(
         struct avl_tree *tree, 
@@ -125,6 +311,21 @@ struct avl_node *avl_add(
         struct avl_kv key, 
         struct avl_kv value);
 
+/** Add a new entry, copying value_size bytes into its inline value. */
+struct avl_node *avl_add_inline(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        const void *value);
+
+/** Remove the entry with the given key, copying its inline value out. */
+struct avl_tree *avl_remove_inline(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        struct avl_kv *rkey,
+        void *rvalue);
+
 /** Remove the entry with the given key. */
 struct avl_tree *avl_remove(
         struct avl_tree *tree, 
@@ -133,15 +334,33 @@ struct avl_tree *avl_remove(
         struct avl_kv *rkey,
         struct avl_kv *rvalue);
 
+/** Remove the given node from the tree. */
+struct avl_tree *avl_remove_node(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Move the node to a new key without reallocating it (string keys too). */
+struct avl_node *avl_rekey(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node,
+        struct avl_kv key);
+
 /** Look up the key's node. */
 struct avl_node *avl_get(
         struct avl_tree *tree, 
         struct avl_kv key);
 
-/** Get the tree's minimum node */
+/** Get the node's inline value, or NULL if the tree has none. */
+void *avl_value(struct avl_tree *tree, struct avl_node *node);
+
+/** Get the tree's minimum node in constant time. */
 struct avl_node *avl_min(struct avl_tree *tree);
 
-/** Get the tree's maximum node. */
+/** Get the tree's maximum node in constant time. */
 struct avl_node *avl_max(struct avl_tree *tree);
 
 /** Remove the first entry. */
@@ -158,6 +377,31 @@ struct avl_tree *avl_remove_max(
         struct avl_kv *rkey,
         struct avl_kv *rvalue);
 
+/** Remove entries from lo to hi inclusive, returning the count removed. */
+size_t avl_remove_range(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv lo,
+        struct avl_kv hi,
+        avl_visit_t visit,
+        void *state);
+
+/** Remove entries less than the key (visit is NULL to free them). */
+size_t avl_truncate_below(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        avl_visit_t visit,
+        void *state);
+
+/** Remove entries greater than the key (visit is NULL to free them). */
+size_t avl_truncate_above(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        avl_visit_t visit,
+        void *state);
+
 /** Traverse in descending order. */
 struct avl_stack *avl_reversed(
         struct avl_tree *tree, 
@@ -178,6 +422,102 @@ int avl_prior(
         struct avl_stack *stack,
         struct avl_node **result);
 
+/** Ascending traversal from the first entry equal to the key. */
+struct avl_stack *avl_equal_range(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key);
+
+/** Count the entries equal to the key. */
+size_t avl_count(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key);
+
+/** Initialize an empty merge, descending if reversed. */
+struct avl_merge *avl_merge_init(
+        struct avl_merge *merge,
+        unsigned int policy,
+        int reversed);
+
+/** Add a source whose stack was positioned by avl_traverse, avl_upper, etc. */
+struct avl_merge *avl_merge_add(
+        struct avl_merge *merge,
+        struct avl_tree *tree,
+        struct avl_stack *stack);
+
+/** Yield the next entry across all sources, and its source's number. */
+int avl_merge_next(
+        struct avl_merge *merge,
+        struct avl_node **result,
+        size_t *source);
+
+#ifdef AVL_MERKLE
+/** Digest u64 keys and values. */
+uint64_t avl_digest_u64(struct avl_kv key, struct avl_kv value);
+
+/** Digest NUL terminated string keys and u64 values. */
+uint64_t avl_str_digest(struct avl_kv key, struct avl_kv value);
+
+/** Set the entry digest function of an empty avl_tree. */
+struct avl_tree *avl_tree_digest(struct avl_tree *tree, avl_digest_t digest);
+
+/** Refresh the node's digest after its value was changed in place. */
+struct avl_tree *avl_merkle_update(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node);
+
+/** Get the order independent hash of all the tree's entries. */
+uint64_t avl_merkle_hash(struct avl_tree *tree);
+
+/** Get the hash of the entries with keys in [lo, hi]. */
+uint64_t avl_merkle_range(
+        struct avl_tree *tree,
+        struct avl_kv lo,
+        struct avl_kv hi);
+
+/** Visit the keys whose entries differ between the trees; return the count. */
+size_t avl_merkle_diff(
+        struct avl_tree *a,
+        struct avl_tree *b,
+        avl_diff_t visit,
+        void *state);
+#endif
+
+/** Compare NUL terminated string keys. */
+int avl_str_cmp(struct avl_kv a, struct avl_kv b);
+
+/** Initialize an avl_tree of NUL terminated keys held in avl_str_nodes. */
+struct avl_tree *avl_str_tree_init(
+        struct avl_tree *tree,
+        avl_alloc_t alloc,
+        avl_free_t free,
+        void *state);
+
+/** Add a new string keyed entry unless it exists (length is strlen(key)). */
+struct avl_node *avl_str_add(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        const char *key,
+        size_t length,
+        struct avl_kv value);
+
+/** Remove the entry with the string key (length is strlen(key)). */
+struct avl_tree *avl_str_remove(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        const char *key,
+        size_t length,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Look up the string key's node (length is strlen(key)). */
+struct avl_node *avl_str_get(
+        struct avl_tree *tree,
+        const char *key,
+        size_t length);
+
 /** Ascending traversal from entries equal to or greater than the key. */
 struct avl_stack *avl_upper(
         struct avl_tree *tree, 
@@ -0,0 +1,56 @@
+#ifndef PUBAVL_AVL_PAR_H
+#define PUBAVL_AVL_PAR_H
+
+#include "pubavl/avl.h"
+
+#ifndef AVL_PAR_DEPTH
+#define AVL_PAR_DEPTH 7
+#endif
+
+#if AVL_PAR_DEPTH < 1 || AVL_PAR_DEPTH > 12
+#error "AVL_PAR_DEPTH must be between 1 and 12"
+#endif
+
+/** Pieces a scan cuts the tree into (subtrees at AVL_PAR_DEPTH, ancestors) */
+#define AVL_PAR_PIECES (2 << AVL_PAR_DEPTH)
+
+/** Maximum worker threads per scan (including the caller) */
+#define AVL_PAR_THREADS 64
+
+/** Ordered Visitor: called once per live entry with its ascending rank */
+typedef void (*avl_par_rank_t)(
+        void *state,
+        struct avl_node *node,
+        size_t rank);
+
+/** Reduce Visitor: folds a live entry into its thread's local state */
+typedef void (*avl_par_visit_t)(void *local, struct avl_node *node);
+
+/** Reduce Merge: folds one thread's local state into the result */
+typedef void (*avl_par_merge_t)(void *state, void *local);
+
+/** Visit every live entry on worker threads, passing its rank in the tree. */
+struct avl_tree *avl_par_ranked(
+        struct avl_tree *tree,
+        size_t threads,
+        avl_par_rank_t visit,
+        void *state);
+
+/** Copy entries in key order into arrays of tree->size (NULL to skip one). */
+struct avl_tree *avl_par_export(
+        struct avl_tree *tree,
+        size_t threads,
+        struct avl_kv *keys,
+        struct avl_kv *values);
+
+/** Fold entries into threads locals of local_size bytes, then merge each. */
+struct avl_tree *avl_par_reduce(
+        struct avl_tree *tree,
+        size_t threads,
+        avl_par_visit_t visit,
+        void *locals,
+        size_t local_size,
+        avl_par_merge_t merge,
+        void *state);
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef PUBAVL_BPT_H
+#define PUBAVL_BPT_H
+
+#include "pubavl/avl.h"
+
+#ifndef BPT_ORDER
+#define BPT_ORDER 16
+#endif
+
+#if BPT_ORDER < 4
+#error "BPT_ORDER must be at least 4"
+#endif
+
+/** B+ Tree Node (one spare slot absorbs overflow before a split) */
+struct bpt_node {
+        size_t count;
+        int leaf;
+        struct avl_kv keys[BPT_ORDER + 1];
+        union {
+                struct bpt_node *children[BPT_ORDER + 2];
+                struct {
+                        struct avl_kv values[BPT_ORDER + 1];
+                        struct bpt_node *prev;
+                        struct bpt_node *next;
+                } leaf;
+        } u;
+};
+
+/** B+ Tree Node Allocation */
+typedef struct bpt_node *(*bpt_alloc_t)(void *heap);
+
+/** B+ Tree Node Free */
+typedef void (*bpt_free_t)(void *heap, struct bpt_node *node);
+
+/** Wide Balanced Search Tree */
+struct bpt_tree {
+        struct bpt_node *root;
+        size_t size;
+        avl_cmp_t cmp;
+        bpt_alloc_t alloc;
+        bpt_free_t free;
+        void *heap;
+        int i64;
+};
+
+/** Position within a B+ Tree's leaves */
+struct bpt_cursor {
+        struct bpt_node *leaf;
+        size_t index;
+};
+
+/** Compare i64 keys. */
+int bpt_cmp_i64(struct avl_kv a, struct avl_kv b);
+
+/** Initialize a bpt_tree. */
+struct bpt_tree *bpt_tree_init(
+        struct bpt_tree *tree,
+        avl_cmp_t cmp,
+        bpt_alloc_t alloc,
+        bpt_free_t free,
+        void *state);
+
+/** Initialize a bpt_tree keyed by i64 and searched with SIMD if available. */
+struct bpt_tree *bpt_tree_init_i64(
+        struct bpt_tree *tree,
+        bpt_alloc_t alloc,
+        bpt_free_t free,
+        void *state);
+
+/** Free all the tree's nodes. */
+void bpt_free_nodes(struct bpt_tree *tree);
+
+/** Add a new entry unless it already exists, returning its value slot. */
+struct avl_kv *bpt_add(
+        struct bpt_tree *tree,
+        struct avl_kv key,
+        struct avl_kv value);
+
+/** Remove the entry with the given key. */
+struct bpt_tree *bpt_remove(
+        struct bpt_tree *tree,
+        struct avl_kv key,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Look up the key's value slot.  Valid until the tree is modified. */
+struct avl_kv *bpt_get(
+        struct bpt_tree *tree,
+        struct avl_kv key);
+
+/** Get the tree's minimum entry. */
+struct bpt_tree *bpt_min(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Get the tree's maximum entry. */
+struct bpt_tree *bpt_max(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Remove the first entry. */
+struct bpt_tree *bpt_remove_min(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Remove the last entry. */
+struct bpt_tree *bpt_remove_max(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Traverse in descending order. */
+struct bpt_cursor *bpt_reversed(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor);
+
+/** Traverse in ascending order. */
+struct bpt_cursor *bpt_traverse(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor);
+
+/** Iterate forward one step.  Can only be used with ascending traversal. */
+int bpt_next(
+        struct bpt_cursor *cursor,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Iterate backward one step. Can only be used with descending traversal. */
+int bpt_prior(
+        struct bpt_cursor *cursor,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue);
+
+/** Ascending traversal from entries equal to or greater than the key. */
+struct bpt_cursor *bpt_upper(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor,
+        struct avl_kv key);
+
+/** Descending traversal from entries equal to or less than the key. */
+struct bpt_cursor *bpt_lower(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor,
+        struct avl_kv key);
+
+#endif
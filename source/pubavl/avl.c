@@ -3,6 +3,64 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+
+#ifdef AVL_STATS
+#define AVL_STAT(TREE, FIELD, N) ((TREE)->stats.FIELD += (N))
+#else
+#define AVL_STAT(TREE, FIELD, N) ((void)0)
+#endif
+
+#if defined(AVL_FULL_RETRACE) || defined(AVL_MERKLE)
+#define AVL_EARLY_RETRACE 0
+#else
+#define AVL_EARLY_RETRACE 1
+#endif
+
+/** Bloom filter block: 8 words of 64 bits, one cache line */
+#define AVL_FILTER_WORDS 8
+
+/** Bloom filter sizing: at least 16 bits per key */
+#define AVL_FILTER_KEYS 32
+
+#define AVL_LESS(TREE, A, B) (AVL_STAT(TREE, compares, 1), (TREE)->cmp(A, B))
+
+/** A string key with its length and big endian 8 byte prefix. */
+struct avl_str_key {
+        const char *key;
+        size_t length;
+        uint64_t prefix;
+};
+
+/** avl_node_walk turn: the descent followed a left link */
+#define AVL_TURN_LEFT 0x1
+
+/** avl_node_walk turn: the descent followed a right link */
+#define AVL_TURN_RIGHT 0x2
+
+/** Order a probe against a node: below 0 goes left, above 0 goes right. */
+typedef int (*avl_step_t)(
+        struct avl_tree *tree,
+        const void *probe,
+        struct avl_node *node);
+
+#ifdef AVL_COUNTS
+/** A node and the total access weight up to and including it. */
+struct avl_weight {
+        struct avl_node *node;
+        uint64_t total;
+};
+#endif
+
+#ifdef AVL_MERKLE
+/** One tree's share of a key range compared by avl_merkle_diff. */
+struct avl_merkle_side {
+        struct avl_node *pivot;
+        uint64_t base;
+        uint64_t lo;
+        uint64_t hi;
+};
+#endif
 
 struct avl_stack *avl_stack_init(struct avl_stack *stack)
 {
@@ -57,13 +115,18 @@ struct avl_node *avl_stack_peek(struct avl_stack *stack)
 struct avl_node *avl_node_init(
         struct avl_node *node,
         struct avl_kv key,
-        struct avl_kv value) 
+        struct avl_kv value,
+        struct avl_tree *tree) 
 {
+        (void)tree;
         assert(node);
         (void)memset(node, 0, sizeof(struct avl_node));
         node->key = key;
         node->value = value;
         node->height = 1;
+#ifdef AVL_MERKLE
+        node->digest = node->merkle = tree->digest(key, value);
+#endif
         return node;
 }
 
@@ -72,16 +135,46 @@ ssize_t avl_node_height(struct avl_node *node)
         if(!node) {
                 return 0;
         } 
-        assert(0 < node->height && node->height <= AVL_STACK_MAX);
-        return node->height;
+        const ssize_t height = node->height & ~AVL_DEAD;
+        assert(0 < height && height <= AVL_STACK_MAX);
+        return height;
+}
+
+#ifdef AVL_MERKLE
+uint64_t avl_node_merkle(struct avl_node *node)
+{
+        return node ? node->merkle : 0;
+}
+
+struct avl_node *avl_node_update_merkle(struct avl_node *node)
+{
+        node->merkle = node->digest + 
+                avl_node_merkle(node->left) + avl_node_merkle(node->right);
+        return node;
+}
+
+void avl_stack_add_merkle(
+        struct avl_stack *stack,
+        size_t begin,
+        size_t end,
+        uint64_t delta)
+{
+        for(size_t n = begin; n < end; ++n) {
+                stack->array[n]->merkle += delta;
+        }
 }
+#endif
 
 struct avl_node *avl_node_update_height(struct avl_node *node) 
 {
         assert(node);
         const ssize_t hl = avl_node_height(node->left);
         const ssize_t hr = avl_node_height(node->right);
-        node->height = 1 + (hl < hr ? hr : hl);
+        node->height = (node->height & AVL_DEAD) | 
+                (1 + (hl < hr ? hr : hl));
+#ifdef AVL_MERKLE
+        (void)avl_node_update_merkle(node);
+#endif
         return node;
 }
 
@@ -91,48 +184,75 @@ ssize_t avl_node_balance_factor(struct avl_node *node)
         return avl_node_height(node->right) - avl_node_height(node->left);
 }
 
-struct avl_node *avl_node_rotate_right(struct avl_node *node)
+struct avl_node *avl_node_pivot_right(struct avl_node *node)
 {
         assert(node && node->left);
         struct avl_node *x = node->left;
         struct avl_node *t = x->right;
         x->right = node;
         node->left = t;
-        (void)avl_node_update_height(node);
-        (void)avl_node_update_height(x);
+#ifdef AVL_MERKLE
+        (void)avl_node_update_merkle(node);
+        (void)avl_node_update_merkle(x);
+#endif
         return x;
 }
 
-struct avl_node *avl_node_rotate_left(struct avl_node *node)
+struct avl_node *avl_node_pivot_left(struct avl_node *node)
 {
         assert(node && node->right);
         struct avl_node *y = node->right;
         struct avl_node *t = y->left;
         y->left = node;
         node->right = t;
+#ifdef AVL_MERKLE
+        (void)avl_node_update_merkle(node);
+        (void)avl_node_update_merkle(y);
+#endif
+        return y;
+}
+
+struct avl_node *avl_node_rotate_right(struct avl_node *node)
+{
+        struct avl_node *x = avl_node_pivot_right(node);
+        (void)avl_node_update_height(node);
+        (void)avl_node_update_height(x);
+        return x;
+}
+
+struct avl_node *avl_node_rotate_left(struct avl_node *node)
+{
+        struct avl_node *y = avl_node_pivot_left(node);
         (void)avl_node_update_height(node);
         (void)avl_node_update_height(y);
         return y;
 } 
 
-struct avl_node *avl_node_rebalance(struct avl_node *node) 
+struct avl_node *avl_node_rebalance(
+        struct avl_node *node,
+        struct avl_tree *tree) 
 {
+        (void)tree;
         const ssize_t balance = avl_node_balance_factor(node);
         assert(-3 < balance && balance < 3);
         if(balance > 1) {
                 if(avl_node_balance_factor(node->right) < 0) {
+                        AVL_STAT(tree, double_rotations, 1);
                         node->right = avl_node_rotate_right(node->right);
                         assert(node->right);
                         return avl_node_rotate_left(node);
                 } else {
+                        AVL_STAT(tree, rotations, 1);
                         return avl_node_rotate_left(node);
                 }
         } else if(balance < -1) {
                 if(avl_node_balance_factor(node->left) > 0) {
+                        AVL_STAT(tree, double_rotations, 1);
                         node->left = avl_node_rotate_left(node->left);
                         assert(node->left);
                         return avl_node_rotate_right(node);
                 } else {
+                        AVL_STAT(tree, rotations, 1);
                         return avl_node_rotate_right(node);
                 }
         } else {
@@ -143,12 +263,25 @@ struct avl_node *avl_node_rebalance(struct avl_node *node)
 struct avl_node *avl_stack_rebalance(
         struct avl_stack *stack,
         const size_t nsteps,
-        struct avl_node *top)
+        struct avl_node *top,
+        struct avl_tree *tree)
 {
         assert(top && nsteps <= stack->size && stack->size <= AVL_STACK_MAX);
         struct avl_node *next, *new_top = NULL;
-        new_top = avl_node_rebalance(avl_node_update_height(top));
+        ssize_t height = top->height;
+        const size_t final_size = stack->size - nsteps;
+        new_top = avl_node_rebalance(avl_node_update_height(top), tree);
+        AVL_STAT(tree, retraces, 1);
         for(size_t i = 0; i < nsteps; ++i) {
+                if(AVL_EARLY_RETRACE && 
+                        new_top == top && new_top->height == height) 
+                {
+                        new_top = stack->array[final_size];
+                        while(stack->size > final_size) {
+                                (void)avl_stack_pop(stack);
+                        }
+                        return new_top;
+                }
                 next = avl_stack_pop(stack);
                 assert(next && (next->left == top || next->right == top));
                 if(next->left == top){
@@ -159,83 +292,435 @@ struct avl_node *avl_stack_rebalance(
                         assert(0);
                 }
                 top = next;
-                new_top = avl_node_rebalance(avl_node_update_height(next));
+                height = next->height;
+                new_top = avl_node_rebalance(
+                        avl_node_update_height(next), tree);
+                AVL_STAT(tree, retraces, 1);
         }
         return new_top; 
 }
 
-struct avl_node *avl_node_add(
-        struct avl_node *const root,
+struct avl_node *avl_stack_relink(
         struct avl_stack *stack,
-        struct avl_kv key,
-        struct avl_kv value,
-        avl_cmp_t cmp,
-        avl_alloc_t alloc,
-        void *state,
-        struct avl_node **result)
+        struct avl_node *old,
+        struct avl_node *new)
 {
-        struct avl_node *new_node, *top, *srch, **addr = NULL;
-        assert(alloc && result);
-        if(!root) {
-                new_node = alloc(state);
-                if(!new_node) {
-                        goto FAILURE;
+        struct avl_node *parent = avl_stack_peek(stack);
+        if(!parent) {
+                return new;
+        } else if(parent->left == old) {
+                parent->left = new;
+        } else {
+                assert(parent->right == old);
+                parent->right = new;
+        }
+        return stack->array[0];
+}
+
+struct avl_node *avl_wavl_insert_fixup(
+        struct avl_stack *stack,
+        struct avl_node *x,
+        struct avl_tree *tree)
+{
+        (void)tree;
+        struct avl_node *p, *z, *top;
+        for(size_t I = 0; I < 2 * AVL_STACK_MAX; ++I) {
+                p = avl_stack_peek(stack);
+                if(!p || avl_node_height(p) != avl_node_height(x)) {
+                        break;
+                }
+                const int left = p->left == x;
+                if(avl_node_height(p) -
+                        avl_node_height(left ? p->right : p->left) == 1)
+                {
+                        AVL_STAT(tree, retraces, 1);
+                        p->height += 1;
+                        x = avl_stack_pop(stack);
+                        continue;
+                }
+                (void)avl_stack_pop(stack);
+                z = left ? x->right : x->left;
+                if(avl_node_height(x) - avl_node_height(z) == 2) {
+                        AVL_STAT(tree, rotations, 1);
+                        top = left ? 
+                                avl_node_pivot_right(p) : 
+                                avl_node_pivot_left(p);
+                        p->height -= 1;
+                } else {
+                        AVL_STAT(tree, double_rotations, 1);
+                        if(left) {
+                                p->left = avl_node_pivot_left(x);
+                                top = avl_node_pivot_right(p);
+                        } else {
+                                p->right = avl_node_pivot_right(x);
+                                top = avl_node_pivot_left(p);
+                        }
+                        z->height += 1;
+                        x->height -= 1;
+                        p->height -= 1;
+                }
+                return avl_stack_relink(stack, p, top);
+        }
+        return stack->size ? stack->array[0] : x;
+}
+
+struct avl_node *avl_wavl_remove_fixup(
+        struct avl_stack *stack,
+        struct avl_node *x,
+        int left,
+        struct avl_tree *tree)
+{
+        (void)tree;
+        struct avl_node *p = avl_stack_peek(stack);
+        struct avl_node *s, *t, *u, *top;
+        if(p && !p->left && !p->right && avl_node_height(p) == 2) {
+                AVL_STAT(tree, retraces, 1);
+                p->height -= 1;
+                x = avl_stack_pop(stack);
+                p = avl_stack_peek(stack);
+                left = p && p->left == x;
+        }
+        for(size_t I = 0; I < 2 * AVL_STACK_MAX && p; ++I) {
+                if(avl_node_height(p) - avl_node_height(x) != 3) {
+                        break;
+                }
+                s = left ? p->right : p->left;
+                assert(s);
+                if(avl_node_height(p) - avl_node_height(s) == 2) {
+                        AVL_STAT(tree, retraces, 1);
+                        p->height -= 1;
+                } else if(
+                        avl_node_height(s) - avl_node_height(s->left) == 2 &&
+                        avl_node_height(s) - avl_node_height(s->right) == 2)
+                {
+                        AVL_STAT(tree, retraces, 1);
+                        p->height -= 1;
+                        s->height -= 1;
                 } else {
-                        *result = avl_node_init(new_node, key, value);
-                        return new_node;
+                        (void)avl_stack_pop(stack);
+                        t = left ? s->right : s->left;
+                        if(avl_node_height(s) - avl_node_height(t) == 1) {
+                                AVL_STAT(tree, rotations, 1);
+                                top = left ?
+                                        avl_node_pivot_left(p) :
+                                        avl_node_pivot_right(p);
+                                s->height += 1;
+                                p->height -= 1;
+                                if(!p->left && !p->right) {
+                                        p->height -= 1;
+                                }
+                        } else {
+                                AVL_STAT(tree, double_rotations, 1);
+                                u = left ? s->left : s->right;
+                                if(left) {
+                                        p->right = avl_node_pivot_right(s);
+                                        top = avl_node_pivot_left(p);
+                                } else {
+                                        p->left = avl_node_pivot_left(s);
+                                        top = avl_node_pivot_right(p);
+                                }
+                                u->height += 2;
+                                s->height -= 1;
+                                p->height -= 2;
+                        }
+                        return avl_stack_relink(stack, p, top);
+                }
+                x = avl_stack_pop(stack);
+                p = avl_stack_peek(stack);
+                left = p && p->left == x;
+        }
+        return stack->size ? stack->array[0] : x;
+}
+
+struct avl_node *avl_wavl_remove_ent(
+        struct avl_node *root,
+        struct avl_stack *stack,
+        struct avl_node **addr,
+        struct avl_node **entry,
+        struct avl_tree *tree)
+{
+        struct avl_node *ent = *entry;
+        struct avl_node *succ, *patch;
+        int left;
+        if(!ent->left || !ent->right) {
+                patch = ent->left ? ent->left : ent->right;
+                if(!addr) {
+                        assert(!stack->size);
+                        return patch;
+                }
+                left = addr == &avl_stack_peek(stack)->left;
+                *addr = patch;
+#ifdef AVL_MERKLE
+                (void)avl_stack_add_merkle(
+                        stack, 0, stack->size, 0 - ent->digest);
+#endif
+                return avl_wavl_remove_fixup(stack, patch, left, tree);
+        }
+        const size_t index = stack->size;
+        if(!avl_stack_push(stack, ent)) {
+                *entry = NULL;
+                return root;
+        }
+        succ = ent->right;
+        for(size_t I = 0; I < AVL_STACK_MAX && succ->left; ++I) {
+                if(!avl_stack_push(stack, succ)) {
+                        *entry = NULL;
+                        return root;
+                }
+                succ = succ->left;
+        }
+        patch = succ->right;
+#ifdef AVL_MERKLE
+        (void)avl_stack_add_merkle(stack, 0, index, 0 - ent->digest);
+        (void)avl_stack_add_merkle(
+                stack, index + 1, stack->size, 0 - succ->digest);
+        succ->merkle = ent->merkle - ent->digest;
+#endif
+        if(avl_stack_peek(stack) == ent) {
+                left = 0;
+        } else {
+                left = 1;
+                avl_stack_peek(stack)->left = patch;
+                succ->right = ent->right;
+        }
+        succ->left = ent->left;
+        succ->height = (succ->height & AVL_DEAD) | avl_node_height(ent);
+        stack->array[index] = succ;
+        if(addr) {
+                *addr = succ;
+        } 
+        return avl_wavl_remove_fixup(stack, patch, left, tree);
+}
+
+struct avl_node *avl_stack_linked(
+        struct avl_stack *stack,
+        struct avl_node *node,
+        struct avl_tree *tree)
+{
+        struct avl_node *top;
+        if(tree->mode & AVL_WAVL) {
+#ifdef AVL_MERKLE
+                (void)avl_stack_add_merkle(stack, 0, stack->size, node->digest);
+#endif
+                return avl_wavl_insert_fixup(stack, node, tree);
+        }
+        top = avl_stack_pop(stack);
+        assert(top && (top->left == node || top->right == node));
+        return avl_stack_rebalance(stack, stack->size, top, tree);
+}
+
+struct avl_node *avl_node_alloc(
+        struct avl_tree *tree,
+        struct avl_node *spare)
+{
+        struct avl_node *node = spare;
+        if(!node) {
+                node = tree->alloc(tree->heap);
+                if(node) {
+                        AVL_STAT(tree, allocs, 1);
+                }
+        }
+        return node;
+}
+
+uint64_t avl_str_prefix(const char *key, size_t length)
+{
+        const unsigned char *bytes = (const unsigned char*)key;
+        const size_t n = length < sizeof(uint64_t) ? length : sizeof(uint64_t);
+        uint64_t prefix = 0;
+        assert(key && !key[length]);
+        for(size_t i = 0; i < sizeof(uint64_t); ++i) {
+                prefix <<= 8;
+                if(i < n) {
+                        prefix |= bytes[i];
+                }
+        }
+        return prefix;
+}
+
+struct avl_str_key *avl_str_key_init(
+        struct avl_str_key *str,
+        const char *key,
+        size_t length)
+{
+        str->key = key;
+        str->length = length;
+        str->prefix = avl_str_prefix(key, length);
+        return str;
+}
+
+int avl_str_order(const struct avl_str_key *str, struct avl_node *node)
+{
+        struct avl_str_node *snode = (struct avl_str_node*)node;
+        const size_t length = str->length;
+        if(str->prefix != snode->prefix) {
+                return str->prefix < snode->prefix ? -1 : 1;
+        } 
+        const size_t n = length < snode->length ? length : snode->length;
+        if(n > sizeof(uint64_t)) {
+                const int order = memcmp(
+                        str->key + sizeof(uint64_t), 
+                        (const char*)node->key.u.ptr + sizeof(uint64_t), 
+                        n - sizeof(uint64_t));
+                if(order) {
+                        return order;
                 }
         }
+        if(length == snode->length) {
+                return 0;
+        } 
+        return length < snode->length ? -1 : 1;
+}
+
+int avl_kv_step(
+        struct avl_tree *tree,
+        const void *probe,
+        struct avl_node *node)
+{
+        const struct avl_kv *key = probe;
+        if(AVL_LESS(tree, *key, node->key)) {
+                return -1;
+        }
+        return AVL_LESS(tree, node->key, *key);
+}
+
+int avl_str_step(
+        struct avl_tree *tree,
+        const void *probe,
+        struct avl_node *node)
+{
+        (void)tree;
+        AVL_STAT(tree, compares, 1);
+        return avl_str_order(probe, node);
+}
+
+avl_step_t avl_tree_probe(
+        struct avl_tree *tree,
+        const struct avl_kv *key,
+        struct avl_str_key *str,
+        const void **probe)
+{
+        if(tree->mode & AVL_STR) {
+                *probe = avl_str_key_init(str, key->u.ptr, strlen(key->u.ptr));
+                return avl_str_step;
+        }
+        *probe = key;
+        return avl_kv_step;
+}
+
+struct avl_node *avl_node_walk(
+        struct avl_node *root,
+        struct avl_stack *stack,
+        avl_step_t step,
+        const void *probe,
+        const int multi,
+        struct avl_tree *tree,
+        struct avl_node ***addr,
+        unsigned int *turns)
+{
+        struct avl_node *srch = root;
+        int order;
+        *addr = NULL;
         (void)avl_stack_reset(stack);
-        srch = root;
         for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
                 if(!srch) {
-                        goto FINISH;
-                } else if(cmp(key, srch->key)) {
-                        if(!avl_stack_push(stack, srch)) {
-                                goto FAILURE;
-                        } else {
-                                addr = &srch->left;
-                                srch = srch->left;
-                        }
-                } else if(cmp(srch->key, key)) {
-                        if(!avl_stack_push(stack, srch)) {
-                                goto FAILURE;
-                        } else {
-                                addr = &srch->right;
-                                srch = srch->right;
-                        }
-                } else {
+                        return NULL;
+                } 
+                order = step(tree, probe, srch);
+                if(!order && !multi) {
+                        return srch;
+                } else if(!avl_stack_push(stack, srch)) {
                         goto FAILURE;
+                } else if(order < 0) {
+                        *addr = &srch->left;
+                        *turns |= AVL_TURN_LEFT;
+                        srch = srch->left;
+                } else {
+                        *addr = &srch->right;
+                        *turns |= AVL_TURN_RIGHT;
+                        srch = srch->right;
                 }
         }
         assert(0);
         FAILURE:
-        *result = NULL;
-        return root;
-        FINISH:
-        assert(addr);
-        new_node = alloc(state);
+        *addr = NULL;
+        return NULL;
+}
+
+struct avl_node *avl_node_insert(
+        struct avl_node *const root,
+        struct avl_stack *stack,
+        avl_step_t step,
+        const void *probe,
+        struct avl_kv key,
+        struct avl_kv value,
+        struct avl_node *spare,
+        struct avl_tree *tree,
+        struct avl_node **result)
+{
+        struct avl_node *new_node, **addr = NULL;
+        const int multi = (tree->mode & AVL_MULTI) != 0;
+        unsigned int turns = 0;
+        assert(tree->alloc && result);
+        if(root && (avl_node_walk(root, stack, step, probe,
+                multi, tree, &addr, &turns) || !addr))
+        {
+                goto FAILURE;
+        }
+        new_node = avl_node_alloc(tree, spare);
         if(!new_node) {
                 goto FAILURE;
+        } 
+        *result = avl_node_init(new_node, key, value, tree);
+        if(tree->mode & AVL_STR) {
+                const struct avl_str_key *str = probe;
+                ((struct avl_str_node*)new_node)->prefix = str->prefix;
+                ((struct avl_str_node*)new_node)->length = str->length;
         }
-        *addr = *result = avl_node_init(new_node, key, value);
-        top = avl_stack_pop(stack);
-        assert(top && (top->left == new_node || top->right == new_node));
-        return avl_stack_rebalance(stack, stack->size, top);
+        if(!(turns & AVL_TURN_RIGHT)) {
+                tree->min = new_node;
+        }
+        if(!(turns & AVL_TURN_LEFT)) {
+                tree->max = new_node;
+        }
+        if(!root) {
+                return new_node;
+        } 
+        *addr = new_node;
+        return avl_stack_linked(stack, new_node, tree);
+        FAILURE:
+        *result = NULL;
+        return root;
+}
+
+struct avl_node *avl_node_add(
+        struct avl_node *const root,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        struct avl_kv value,
+        struct avl_node *spare,
+        struct avl_tree *tree,
+        struct avl_node **result)
+{
+        struct avl_str_key str;
+        const void *probe;
+        const avl_step_t step = avl_tree_probe(tree, &key, &str, &probe);
+        return avl_node_insert(
+                root, stack, step, probe, key, value, spare, tree, result);
 }
 
 struct avl_node *avl_node_get(
         struct avl_node *node, 
         struct avl_kv key,
-        avl_cmp_t cmp)
+        struct avl_tree *tree)
 {
-        assert(cmp);
+        assert(tree->cmp);
         for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
                 if(!node) {
                         return NULL;
-                } else if(cmp(key, node->key)) {
+                } else if(AVL_LESS(tree, key, node->key)) {
                         node = node->left;
-                } else if(cmp(node->key, key)) {
+                } else if(AVL_LESS(tree, node->key, key)) {
                         node = node->right;
                 } else {
                         return node;
@@ -249,7 +734,8 @@ struct avl_node *avl_node_remove_ent_nary(
         struct avl_node *root,
         struct avl_stack *stack,
         struct avl_node **addr,
-        struct avl_node **entry)
+        struct avl_node **entry,
+        struct avl_tree *tree)
 {
         struct avl_node *top = NULL;
         struct avl_node *succ = (*entry)->right;
@@ -272,9 +758,9 @@ struct avl_node *avl_node_remove_ent_nary(
         assert(stack->size >= saved_size && top && top->left == succ);
         top->left = succ->right;
         succ->right = avl_stack_rebalance(
-                stack, stack->size - saved_size, top);
+                stack, stack->size - saved_size, top, tree);
         succ->left = (*entry)->left;
-        succ = avl_node_rebalance(avl_node_update_height(succ));
+        succ = avl_node_rebalance(avl_node_update_height(succ), tree);
         if(!addr) {
                 assert(!stack->size);
                 return succ;
@@ -282,28 +768,32 @@ struct avl_node *avl_node_remove_ent_nary(
         *addr = succ;
         top = avl_stack_pop(stack);
         assert(top && (top->left == succ || top->right == succ));
-        return avl_stack_rebalance(stack, stack->size, top);
+        return avl_stack_rebalance(stack, stack->size, top, tree);
 }
 
 struct avl_node *avl_node_remove_ent(
         struct avl_node *root,
         struct avl_stack *stack,
         struct avl_node **addr,
-        struct avl_node **entry)
+        struct avl_node **entry,
+        struct avl_tree *tree)
 {
         struct avl_node *patch, *top = NULL;
         struct avl_node *ent = *entry;
         assert(ent);
-        if(!ent->left) {
+        if(tree->mode & AVL_WAVL) {
+                return avl_wavl_remove_ent(root, stack, addr, entry, tree);
+        } else if(!ent->left) {
                 patch = ent->right;
         } else if(!ent->right) {
                 patch = ent->left;
         } else if(!ent->right->left) {
                 ent->right->left = ent->left;
                 patch = avl_node_rebalance(
-                        avl_node_update_height(ent->right));
+                        avl_node_update_height(ent->right), tree);
         } else {
-                return avl_node_remove_ent_nary(root, stack, addr, entry);
+                return avl_node_remove_ent_nary(
+                        root, stack, addr, entry, tree);
         } 
         if(!addr) {
                 assert(!stack->size);
@@ -312,49 +802,39 @@ struct avl_node *avl_node_remove_ent(
         *addr = patch;
         top = avl_stack_pop(stack);
         assert(top && (top->left == patch || top->right == patch));
-        return avl_stack_rebalance(stack, stack->size, top);
+        return avl_stack_rebalance(stack, stack->size, top, tree);
+}
+
+struct avl_node *avl_node_delete(
+        struct avl_node *root,
+        struct avl_stack *stack,
+        avl_step_t step,
+        const void *probe,
+        struct avl_tree *tree,
+        struct avl_node **entry)
+{
+        struct avl_node **addr = NULL;
+        unsigned int turns = 0;
+        assert(entry);
+        *entry = root ? avl_node_walk(
+                root, stack, step, probe, 0, tree, &addr, &turns) : NULL;
+        if(!*entry) {
+                return root;
+        } 
+        return avl_node_remove_ent(root, stack, addr, entry, tree);
 }
 
 struct avl_node *avl_node_remove(
         struct avl_node *root,
         struct avl_stack *stack,
         struct avl_kv key, 
-        avl_cmp_t cmp,
+        struct avl_tree *tree,
         struct avl_node **entry)
 {
-        assert(cmp && entry);
-        if(!root) {
-                goto FAILURE;
-        } 
-        (void)avl_stack_reset(stack);
-        struct avl_node *srch = root;
-        struct avl_node **addr = NULL;
-        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
-                if(!srch) {
-                        goto FAILURE;
-                } else if(cmp(key, srch->key)) {
-                        if(!avl_stack_push(stack, srch)) {
-                                goto FAILURE;
-                        } else {
-                                addr = &srch->left;
-                                srch = srch->left;
-                        }
-                } else if(cmp(srch->key, key)) {
-                        if(!avl_stack_push(stack, srch)) {
-                                goto FAILURE;
-                        } else {
-                                addr = &srch->right;
-                                srch = srch->right;
-                        }
-                } else {
-                        *entry = srch;
-                        return avl_node_remove_ent(root, stack, addr, entry);
-                }
-        }
-        assert(0);
-        FAILURE:
-        *entry = NULL;
-        return root;
+        struct avl_str_key str;
+        const void *probe;
+        const avl_step_t step = avl_tree_probe(tree, &key, &str, &probe);
+        return avl_node_delete(root, stack, step, probe, tree, entry);
 }
 
 struct avl_node *avl_node_min(struct avl_node *node)
@@ -422,7 +902,8 @@ struct avl_stack *avl_node_traverse(
 struct avl_node *avl_node_remove_first(
         struct avl_node *const root, 
         struct avl_stack *stack,
-        struct avl_node **min)
+        struct avl_node **min,
+        struct avl_tree *tree)
 {
         assert(min);
         if(!root) {
@@ -434,7 +915,8 @@ struct avl_node *avl_node_remove_first(
         for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
                 if(!srch->left) {
                         *min = srch;
-                        return avl_node_remove_ent(root, stack, addr, min);
+                        return avl_node_remove_ent(
+                                root, stack, addr, min, tree);
                 } else if(!avl_stack_push(stack, srch)) {
                         goto FAILURE;
                 } else {
@@ -451,7 +933,8 @@ struct avl_node *avl_node_remove_first(
 struct avl_node *avl_node_remove_last(
         struct avl_node *root, 
         struct avl_stack *stack,
-        struct avl_node **max)
+        struct avl_node **max,
+        struct avl_tree *tree)
 {
         assert(max);
         if(!root) {
@@ -463,7 +946,8 @@ struct avl_node *avl_node_remove_last(
         for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
                 if(!srch->right) {
                         *max = srch;
-                        return avl_node_remove_ent(root, stack, addr, max);
+                        return avl_node_remove_ent(
+                                root, stack, addr, max, tree);
                 } else if(!avl_stack_push(stack, srch)) {
                         goto FAILURE;
                 } else {
@@ -477,96 +961,1319 @@ struct avl_node *avl_node_remove_last(
         return root;
 }
 
-struct avl_stack *avl_node_upper(
-        struct avl_node *node, 
+int avl_step_next(
         struct avl_stack *stack,
-        struct avl_kv key, 
-        avl_cmp_t cmp)
+        struct avl_node **result)
 {
-        (void)avl_stack_reset(stack);
-        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
-                if(cmp(key, node->key)) {
-                        if(!avl_stack_push(stack, node)) {
-                                return NULL;
-                        } else if(node->left == NULL) {
-                                return stack;
-                        } 
-                        node = node->left;
-                } else if(cmp(node->key, key)) {
-                        if(node->right == NULL) {
-                                return stack;
-                        } 
-                        node = node->right;
-                } else {
-                        if(!avl_stack_push(stack, node)) {
-                                return NULL;
-                        } 
-                        return stack;
+        struct avl_node *node = avl_stack_pop(stack);
+        if(!node) {
+                return 0;
+        } else if(node->right) {
+                for(struct avl_node *n = node->right; n; n = n->left) {
+                        if(!avl_stack_push(stack, n)) {
+                                return 0;
+                        }
                 }
         }
-        assert(0);
-        return NULL;
+        *result = node;
+        return 1;
 }
 
-struct avl_stack *avl_node_lower(
-        struct avl_node *node, 
-        struct avl_kv key, 
-        avl_cmp_t cmp,
-        struct avl_stack *stack)
+int avl_step_prior(
+        struct avl_stack *stack,
+        struct avl_node **result)
 {
-        (void)avl_stack_reset(stack);
-        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
-                if(cmp(key, node->key)) {
-                        if(node->left == NULL) {
-                                return stack;
-                        } 
+        struct avl_node *node = avl_stack_pop(stack);
+        if(!node) {
+                return 0;
+        } else if(node->left) {
+                for(struct avl_node *n = node->left; n; n = n->right) {
+                        if(!avl_stack_push(stack, n)) {
+                                return 0;
+                        }
+                }
+        }
+        *result = node;
+        return 1;
+}
+
+struct avl_stack *avl_node_upper(
+        struct avl_node *node, 
+        struct avl_stack *stack,
+        avl_step_t step,
+        const void *probe,
+        struct avl_tree *tree)
+{
+        int order;
+        (void)avl_stack_reset(stack);
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return stack;
+                } 
+                order = step(tree, probe, node);
+                if(order > 0) {
+                        node = node->right;
+                } else if(!avl_stack_push(stack, node)) {
+                        return NULL;
+                } else if(order < 0 || (tree->mode & AVL_MULTI)) {
+                        node = node->left;
+                } else {
+                        return stack;
+                }
+        }
+        assert(0);
+        return NULL;
+}
+
+struct avl_stack *avl_node_lower(
+        struct avl_node *node, 
+        avl_step_t step,
+        const void *probe,
+        struct avl_tree *tree,
+        struct avl_stack *stack)
+{
+        int order;
+        (void)avl_stack_reset(stack);
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return stack;
+                } 
+                order = step(tree, probe, node);
+                if(order < 0) {
+                        node = node->left;
+                } else if(!avl_stack_push(stack, node)) {
+                        return NULL;
+                } else if(order > 0 || (tree->mode & AVL_MULTI)) {
+                        node = node->right;
+                } else {
+                        return stack;
+                }
+        }
+        assert(0);
+        return NULL;
+}
+
+int avl_node_path(
+        struct avl_node *node,
+        struct avl_stack *stack,
+        struct avl_node *target,
+        struct avl_tree *tree)
+{
+        size_t saved_size;
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return 0;
+                } else if(node == target) {
+                        return 1;
+                } else if(!avl_stack_push(stack, node)) {
+                        return 0;
+                } else if(AVL_LESS(tree, target->key, node->key)) {
+                        node = node->left;
+                } else if(AVL_LESS(tree, node->key, target->key)) {
+                        node = node->right;
+                } else {
+                        saved_size = stack->size;
+                        if(avl_node_path(node->left, stack, target, tree)) {
+                                return 1;
+                        }
+                        while(stack->size > saved_size) {
+                                (void)avl_stack_pop(stack);
+                        }
+                        node = node->right;
+                }
+        }
+        return 0;
+}
+
+struct avl_node *avl_node_remove_node(
+        struct avl_node *root,
+        struct avl_stack *stack,
+        struct avl_tree *tree,
+        struct avl_node **entry)
+{
+        struct avl_node *parent, **addr = NULL;
+        assert(entry && *entry);
+        (void)avl_stack_reset(stack);
+        if(!avl_node_path(root, stack, *entry, tree)) {
+                *entry = NULL;
+                return root;
+        }
+        parent = avl_stack_peek(stack);
+        if(parent) {
+                addr = parent->left == *entry ? &parent->left : &parent->right;
+        }
+        return avl_node_remove_ent(root, stack, addr, entry, tree);
+}
+
+struct avl_tree *avl_tree_init(
+        struct avl_tree *tree,
+        avl_cmp_t cmp,
+        avl_alloc_t alloc,
+        avl_free_t free,
+        void *state)
+{
+        assert(tree);
+        tree->size = 0;
+        tree->dead = 0;
+        tree->root = NULL;
+        tree->min = NULL;
+        tree->max = NULL;
+        tree->cmp = cmp;
+        tree->alloc = alloc;
+        tree->free = free;
+        tree->heap = state;
+        tree->node_size = sizeof(struct avl_node);
+        tree->value_size = 0;
+        tree->mode = 0;
+        tree->defrag = 0;
+        tree->defrag_node = NULL;
+        tree->defrag_old = NULL;
+        tree->shaped = 0;
+        tree->hash = NULL;
+        tree->index = NULL;
+        tree->index_size = 0;
+        tree->filter_hash = NULL;
+        tree->filter = NULL;
+        tree->filter_blocks = 0;
+        tree->filter_stale = 0;
+        tree->cache_hash = NULL;
+        tree->cache = NULL;
+        tree->cache_size = 0;
+#ifdef AVL_STATS
+        (void)avl_stats_reset(tree);
+#endif
+#ifdef AVL_MERKLE
+        tree->digest = avl_digest_u64;
+#endif
+        return tree;
+}
+
+struct avl_tree *avl_tree_mode(struct avl_tree *tree, unsigned int mode)
+{
+        assert(tree && !tree->root);
+        assert(!((mode & AVL_LAZY) && (mode & AVL_MULTI)));
+        assert(!(tree->hash && (mode & AVL_MULTI)));
+        tree->mode = mode | (tree->mode & AVL_STR);
+        return tree;
+}
+
+struct avl_tree *avl_tree_inline(struct avl_tree *tree, size_t value_size)
+{
+        assert(tree && !tree->root);
+        tree->node_size += value_size - tree->value_size;
+        tree->value_size = value_size;
+        return tree;
+}
+
+#ifdef AVL_STATS
+struct avl_tree *avl_stats_reset(struct avl_tree *tree)
+{
+        assert(tree);
+        (void)memset(&tree->stats, 0, sizeof(struct avl_stats));
+        return tree;
+}
+#endif
+
+uint64_t avl_hash_u64(struct avl_kv key)
+{
+        uint64_t x = key.u.u64;
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+}
+
+size_t avl_index_slot(struct avl_tree *tree, struct avl_kv key)
+{
+        return (size_t)tree->hash(key) & (tree->index_size - 1);
+}
+
+void avl_index_insert(struct avl_tree *tree, struct avl_node *node)
+{
+        size_t slot = avl_index_slot(tree, node->key);
+        while(tree->index[slot]) {
+                slot = (slot + 1) & (tree->index_size - 1);
+        }
+        tree->index[slot] = node;
+}
+
+void avl_index_delete(struct avl_tree *tree, struct avl_node *node)
+{
+        const size_t mask = tree->index_size - 1;
+        size_t slot = avl_index_slot(tree, node->key);
+        size_t next, home;
+        while(tree->index[slot] != node) {
+                assert(tree->index[slot]);
+                slot = (slot + 1) & mask;
+        }
+        for(next = (slot + 1) & mask; tree->index[next]; next = (next + 1) & mask) {
+                home = avl_index_slot(tree, tree->index[next]->key);
+                if(((next - home) & mask) >= ((next - slot) & mask)) {
+                        tree->index[slot] = tree->index[next];
+                        slot = next;
+                }
+        }
+        tree->index[slot] = NULL;
+}
+
+struct avl_node *avl_index_get(struct avl_tree *tree, struct avl_kv key)
+{
+        struct avl_node *node;
+        size_t slot = avl_index_slot(tree, key);
+        for(size_t I = 0; I < tree->index_size; ++I) {
+                node = tree->index[slot];
+                if(!node) {
+                        return NULL;
+                } else if(!AVL_LESS(tree, key, node->key) &&
+                        !AVL_LESS(tree, node->key, key))
+                {
+                        return node;
+                }
+                slot = (slot + 1) & (tree->index_size - 1);
+        }
+        assert(0);
+        return NULL;
+}
+
+struct avl_tree *avl_index_resize(struct avl_tree *tree, size_t index_size)
+{
+        struct avl_node **old = tree->index;
+        const size_t old_size = tree->index_size;
+        tree->index = calloc(index_size, sizeof(struct avl_node *));
+        if(!tree->index) {
+                tree->index = old;
+                return NULL;
+        }
+        tree->index_size = index_size;
+        for(size_t n = 0; n < old_size; ++n) {
+                if(old[n]) {
+                        (void)avl_index_insert(tree, old[n]);
+                }
+        }
+        (void)free(old);
+        return tree;
+}
+
+struct avl_tree *avl_tree_index(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        avl_hash_t hash)
+{
+        struct avl_node *node;
+        size_t index_size = 16;
+        assert(tree && !(hash && (tree->mode & AVL_MULTI)));
+        (void)free(tree->index);
+        tree->hash = NULL;
+        tree->index = NULL;
+        tree->index_size = 0;
+        if(!hash) {
+                return tree;
+        }
+        while(index_size < 2 * tree->size) {
+                index_size *= 2;
+        }
+        tree->index = calloc(index_size, sizeof(struct avl_node *));
+        if(!tree->index || !avl_traverse(tree, stack)) {
+                (void)free(tree->index);
+                tree->index = NULL;
+                return NULL;
+        }
+        tree->hash = hash;
+        tree->index_size = index_size;
+        while(avl_next(stack, &node)) {
+                (void)avl_index_insert(tree, node);
+        }
+        return tree;
+}
+
+uint64_t *avl_filter_block(struct avl_tree *tree, uint64_t hash)
+{
+        const size_t block = (size_t)(hash >> 32) & (tree->filter_blocks - 1);
+        return tree->filter + AVL_FILTER_WORDS * block;
+}
+
+uint64_t avl_filter_bit(uint64_t hash, size_t word)
+{
+        static const uint32_t salt[AVL_FILTER_WORDS] = {
+                0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+        };
+        return (uint64_t)1 << (((uint32_t)hash * salt[word]) >> 26);
+}
+
+void avl_filter_insert(struct avl_tree *tree, struct avl_kv key)
+{
+        const uint64_t hash = tree->filter_hash(key);
+        uint64_t *block = avl_filter_block(tree, hash);
+        for(size_t n = 0; n < AVL_FILTER_WORDS; ++n) {
+                block[n] |= avl_filter_bit(hash, n);
+        }
+}
+
+int avl_filter_test(struct avl_tree *tree, struct avl_kv key)
+{
+        const uint64_t hash = tree->filter_hash(key);
+        const uint64_t *block = avl_filter_block(tree, hash);
+        for(size_t n = 0; n < AVL_FILTER_WORDS; ++n) {
+                if(!(block[n] & avl_filter_bit(hash, n))) {
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+struct avl_tree *avl_filter_build(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        avl_hash_t hash)
+{
+        struct avl_node *node;
+        size_t blocks = 1;
+        while(blocks * AVL_FILTER_KEYS < 2 * tree->size) {
+                blocks *= 2;
+        }
+        (void)free(tree->filter);
+        tree->filter = calloc(blocks, AVL_FILTER_WORDS * sizeof(uint64_t));
+        if(!tree->filter || !avl_traverse(tree, stack)) {
+                (void)free(tree->filter);
+                goto FAILURE;
+        }
+        tree->filter_hash = hash;
+        tree->filter_blocks = blocks;
+        tree->filter_stale = 0;
+        while(avl_next(stack, &node)) {
+                (void)avl_filter_insert(tree, node->key);
+        }
+        return tree;
+        FAILURE:
+        tree->filter_hash = NULL;
+        tree->filter = NULL;
+        tree->filter_blocks = 0;
+        tree->filter_stale = 0;
+        return NULL;
+}
+
+struct avl_tree *avl_tree_filter(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        avl_hash_t hash)
+{
+        assert(tree);
+        if(!hash) {
+                (void)free(tree->filter);
+                tree->filter_hash = NULL;
+                tree->filter = NULL;
+                tree->filter_blocks = 0;
+                tree->filter_stale = 0;
+                return tree;
+        }
+        return avl_filter_build(tree, stack, hash);
+}
+
+struct avl_node **avl_cache_slot(struct avl_tree *tree, struct avl_kv key)
+{
+        return tree->cache + 
+                ((size_t)tree->cache_hash(key) & (tree->cache_size - 1));
+}
+
+struct avl_tree *avl_tree_cache(
+        struct avl_tree *tree,
+        avl_hash_t hash,
+        size_t slots)
+{
+        size_t cache_size = 1;
+        assert(tree);
+        (void)free(tree->cache);
+        tree->cache_hash = NULL;
+        tree->cache = NULL;
+        tree->cache_size = 0;
+        if(!hash) {
+                return tree;
+        }
+        while(cache_size < slots) {
+                cache_size *= 2;
+        }
+        tree->cache = calloc(cache_size, sizeof(struct avl_node *));
+        if(!tree->cache) {
+                return NULL;
+        }
+        tree->cache_hash = hash;
+        tree->cache_size = cache_size;
+        return tree;
+}
+
+struct avl_report *avl_report(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_report *report)
+{
+        size_t depths[AVL_STACK_MAX];
+        struct avl_node *node;
+        assert(tree && report);
+        (void)memset(report, 0, sizeof(struct avl_report));
+        report->size = tree->size;
+        report->bytes = (tree->size + tree->dead) * tree->node_size;
+        (void)avl_stack_reset(stack);
+        if(!tree->root) {
+                return report;
+        } else if(!avl_stack_push(stack, tree->root)) {
+                return NULL;
+        }
+        depths[0] = 0;
+        while(stack->size) {
+                const size_t depth = depths[stack->size - 1];
+                node = avl_stack_pop(stack);
+                report->depths[depth] += 1;
+                if(report->height < depth + 1) {
+                        report->height = depth + 1;
+                }
+                if(node->right) {
+                        depths[stack->size] = depth + 1;
+                        if(!avl_stack_push(stack, node->right)) {
+                                return NULL;
+                        }
+                }
+                if(node->left) {
+                        depths[stack->size] = depth + 1;
+                        if(!avl_stack_push(stack, node->left)) {
+                                return NULL;
+                        }
+                }
+        }
+        return report;
+}
+
+void avl_tree_forget(struct avl_tree *tree, struct avl_node *node)
+{
+        if(tree->defrag_node == node) {
+                tree->defrag_node = NULL;
+        }
+}
+
+struct avl_node *avl_tree_relocate(
+        struct avl_tree *tree,
+        struct avl_node *node,
+        struct avl_node *parent,
+        struct avl_node *copy,
+        avl_moved_t moved)
+{
+        struct avl_node **slot;
+        (void)memcpy(copy, node, tree->node_size);
+        if(!parent) {
+                tree->root = copy;
+        } else if(parent->left == node) {
+                parent->left = copy;
+        } else {
+                assert(parent->right == node);
+                parent->right = copy;
+        }
+        if(tree->min == node) {
+                tree->min = copy;
+        }
+        if(tree->max == node) {
+                tree->max = copy;
+        }
+        if(tree->hash && !(node->height & AVL_DEAD)) {
+                (void)avl_index_delete(tree, node);
+                (void)avl_index_insert(tree, copy);
+        }
+        if(tree->cache_hash) {
+                slot = avl_cache_slot(tree, node->key);
+                if(*slot == node) {
+                        *slot = copy;
+                }
+        }
+        if(moved) {
+                moved(tree->heap, node, copy);
+        }
+        node->left = tree->defrag_old;
+        tree->defrag_old = node;
+        return copy;
+}
+
+struct avl_node *avl_node_bound(
+        struct avl_node *node,
+        struct avl_stack *path,
+        struct avl_kv key,
+        struct avl_tree *tree)
+{
+        struct avl_node *result = NULL;
+        size_t size = path->size;
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        while(path->size > size) {
+                                (void)avl_stack_pop(path);
+                        }
+                        return result;
+                } else if(AVL_LESS(tree, node->key, key)) {
+                        if(!avl_stack_push(path, node)) {
+                                return NULL;
+                        }
+                        node = node->right;
+                } else {
+                        result = node;
+                        size = path->size;
+                        if(!avl_stack_push(path, node)) {
+                                return NULL;
+                        }
+                        node = node->left;
+                }
+        }
+        assert(0);
+        return NULL;
+}
+
+struct avl_node *avl_node_successor(
+        struct avl_stack *path,
+        struct avl_node *node)
+{
+        struct avl_node *parent;
+        if(node->right) {
+                if(!avl_stack_push(path, node)) {
+                        return NULL;
+                }
+                for(node = node->right; node->left; node = node->left) {
+                        if(!avl_stack_push(path, node)) {
+                                return NULL;
+                        }
+                }
+                return node;
+        }
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                parent = avl_stack_pop(path);
+                if(!parent || parent->left == node) {
+                        return parent;
+                }
+                node = parent;
+        }
+        assert(0);
+        return NULL;
+}
+
+struct avl_node *avl_defrag_start(
+        struct avl_tree *tree,
+        struct avl_stack *path)
+{
+        struct avl_node *node = tree->root;
+        (void)avl_stack_reset(path);
+        if(tree->defrag && tree->defrag_node) {
+                if(!avl_node_path(node, path, tree->defrag_node, tree)) {
+                        return NULL;
+                }
+                return avl_node_successor(path, tree->defrag_node);
+        } else if(tree->defrag) {
+                return avl_node_bound(node, path, tree->defrag_key, tree);
+        }
+        for(size_t I = 0; node && I < AVL_STACK_MAX; ++I) {
+                if(!node->left) {
+                        return node;
+                } else if(!avl_stack_push(path, node)) {
+                        return NULL;
+                }
+                node = node->left;
+        }
+        return NULL;
+}
+
+void avl_defrag_release(struct avl_tree *tree, struct avl_node *list)
+{
+        struct avl_node *node;
+        while(list) {
+                node = list;
+                list = node->left;
+                AVL_STAT(tree, frees, 1);
+                tree->free(tree->heap, node);
+        }
+}
+
+int avl_defrag(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        size_t budget,
+        avl_moved_t moved)
+{
+        struct avl_node *node, *copy, *copies = NULL, **tail = &copies;
+        size_t n;
+        assert(tree && stack);
+        if(budget > tree->size + tree->dead) {
+                budget = tree->size + tree->dead;
+        }
+        for(n = 0; n < budget; ++n) {
+                copy = tree->alloc(tree->heap);
+                if(!copy) {
+                        goto FAILURE;
+                }
+                AVL_STAT(tree, allocs, 1);
+                copy->left = NULL;
+                *tail = copy;
+                tail = &copy->left;
+        }
+        node = avl_defrag_start(tree, stack);
+        for(; node && copies; node = avl_node_successor(stack, node)) {
+                copy = copies;
+                copies = copy->left;
+                node = avl_tree_relocate(
+                        tree, node, avl_stack_peek(stack), copy, moved);
+                tree->defrag_node = node;
+                tree->defrag_key = node->key;
+                tree->defrag = 1;
+        }
+        (void)avl_defrag_release(tree, copies);
+        if(node) {
+                return 1;
+        }
+        (void)avl_defrag_release(tree, tree->defrag_old);
+        tree->defrag_old = tree->defrag_node = NULL;
+        tree->defrag = 0;
+        return 0;
+        FAILURE:
+        (void)avl_defrag_release(tree, copies);
+        return -1;
+}
+
+void avl_free_nodes(struct avl_tree *tree, struct avl_stack *stack)
+{
+        struct avl_node *node;
+        (void)avl_stack_reset(stack);
+        avl_traverse(tree, stack);
+        for(size_t n = 0; n < tree->size + tree->dead; ++n) {
+                if(!avl_step_next(stack, &node)) {
+                        return;
+                }
+                AVL_STAT(tree, frees, 1);
+                tree->free(tree->heap, node);
+        }
+        tree->root = tree->min = tree->max = NULL;
+        tree->size = tree->dead = 0;
+        tree->defrag = 0;
+        (void)avl_defrag_release(tree, tree->defrag_old);
+        tree->defrag_old = tree->defrag_node = NULL;
+        tree->shaped = 0;
+        if(tree->index) {
+                (void)memset(tree->index, 0, 
+                        tree->index_size * sizeof(struct avl_node *));
+        }
+        if(tree->cache) {
+                (void)memset(tree->cache, 0, 
+                        tree->cache_size * sizeof(struct avl_node *));
+        }
+        if(tree->filter) {
+                (void)memset(tree->filter, 0, tree->filter_blocks * 
+                        AVL_FILTER_WORDS * sizeof(uint64_t));
+                tree->filter_stale = 0;
+        }
+}
+
+void avl_tree_free(struct avl_tree *tree, struct avl_stack *stack)
+{
+        (void)avl_free_nodes(tree, stack);
+        (void)avl_tree_index(tree, stack, NULL);
+        (void)avl_tree_filter(tree, stack, NULL);
+        (void)avl_tree_cache(tree, NULL, 0);
+}
+
+struct avl_node *avl_node_build(struct avl_node **list, const size_t count)
+{
+        struct avl_node *left, *node;
+        if(!count) {
+                return NULL;
+        }
+        left = avl_node_build(list, count / 2);
+        node = *list;
+        *list = node->right;
+        node->left = left;
+        node->right = avl_node_build(list, count - count / 2 - 1);
+        return avl_node_update_height(node);
+}
+
+struct avl_node *avl_node_join(
+        struct avl_node *left,
+        struct avl_node *node,
+        struct avl_node *right,
+        struct avl_tree *tree)
+{
+        const ssize_t hl = avl_node_height(left);
+        const ssize_t hr = avl_node_height(right);
+        if(hl > hr + 1) {
+                left->right = avl_node_join(left->right, node, right, tree);
+                return avl_node_rebalance(avl_node_update_height(left), tree);
+        } else if(hr > hl + 1) {
+                right->left = avl_node_join(left, node, right->left, tree);
+                return avl_node_rebalance(avl_node_update_height(right), tree);
+        }
+        node->left = left;
+        node->right = right;
+        return avl_node_update_height(node);
+}
+
+struct avl_node *avl_node_pop_min(
+        struct avl_node *node,
+        struct avl_node **min,
+        struct avl_tree *tree)
+{
+        if(!node->left) {
+                *min = node;
+                return node->right;
+        }
+        node->left = avl_node_pop_min(node->left, min, tree);
+        return avl_node_rebalance(avl_node_update_height(node), tree);
+}
+
+struct avl_node *avl_node_concat(
+        struct avl_node *left,
+        struct avl_node *right,
+        struct avl_tree *tree)
+{
+        struct avl_node *min = NULL;
+        if(!left) {
+                return right;
+        } else if(!right) {
+                return left;
+        }
+        right = avl_node_pop_min(right, &min, tree);
+        return avl_node_join(left, min, right, tree);
+}
+
+int avl_node_before(
+        struct avl_tree *tree,
+        struct avl_node *node,
+        struct avl_kv key,
+        const int inclusive)
+{
+        if(inclusive) {
+                return !AVL_LESS(tree, key, node->key);
+        }
+        return AVL_LESS(tree, node->key, key);
+}
+
+void avl_node_split(
+        struct avl_node *node,
+        struct avl_kv key,
+        const int inclusive,
+        struct avl_node **left,
+        struct avl_node **right,
+        struct avl_tree *tree)
+{
+        struct avl_node *rest = NULL;
+        if(!node) {
+                *left = *right = NULL;
+        } else if(avl_node_before(tree, node, key, inclusive)) {
+                avl_node_split(node->right, key, inclusive, &rest, right, tree);
+                *left = avl_node_join(node->left, node, rest, tree);
+        } else {
+                avl_node_split(node->left, key, inclusive, left, &rest, tree);
+                *right = avl_node_join(rest, node, node->right, tree);
+        }
+}
+
+struct avl_node *avl_node_after(
+        struct avl_node *node,
+        struct avl_kv key,
+        const int inclusive,
+        struct avl_tree *tree)
+{
+        struct avl_node *result = NULL;
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return result;
+                } else if(avl_node_before(tree, node, key, inclusive)) {
+                        node = node->right;
+                } else {
+                        result = node;
+                        node = node->left;
+                }
+        }
+        assert(0);
+        return NULL;
+}
+
+struct avl_tree *avl_compact(struct avl_tree *tree, struct avl_stack *stack)
+{
+        struct avl_node *node, *head = NULL, **tail = &head;
+        if(!avl_traverse(tree, stack)) {
+                return NULL;
+        }
+        while(avl_step_next(stack, &node)) {
+                if(node->height & AVL_DEAD) {
+                        (void)avl_tree_forget(tree, node);
+                        AVL_STAT(tree, frees, 1);
+                        tree->free(tree->heap, node);
+                } else {
+                        *tail = node;
+                        tail = &node->right;
+                }
+        }
+        *tail = NULL;
+        tree->dead = 0;
+        tree->shaped = 0;
+        tree->root = avl_node_build(&head, tree->size);
+        assert(!head);
+        return tree;
+}
+
+struct avl_tree *avl_tree_settle(
+        struct avl_tree *tree,
+        struct avl_stack *stack)
+{
+        if(tree->shaped) {
+                (void)avl_compact(tree, stack);
+        }
+        return tree;
+}
+
+#ifdef AVL_COUNTS
+struct avl_node *avl_node_weigh(
+        struct avl_weight *list,
+        const size_t lo,
+        const size_t hi,
+        const size_t depth)
+{
+        struct avl_node *node;
+        uint64_t base, half;
+        size_t a = lo, b = hi - 1, cap = SIZE_MAX;
+        const size_t levels = AVL_STACK_MAX - 2 - depth;
+        if(lo >= hi) {
+                return NULL;
+        }
+        assert(depth + 2 <= AVL_STACK_MAX);
+        base = lo ? list[lo - 1].total : 0;
+        half = base + (list[hi - 1].total - base) / 2;
+        while(a < b) {
+                const size_t mid = a + (b - a) / 2;
+                if(list[mid].total <= half) {
+                        a = mid + 1;
+                } else {
+                        b = mid;
+                }
+        }
+        if(levels < 8 * sizeof(size_t)) {
+                cap = ((size_t)1 << levels) - 1;
+        }
+        if(a - lo > cap) {
+                a = lo + cap;
+        }
+        if(hi - 1 - a > cap) {
+                a = hi - 1 - cap;
+        }
+        node = list[a].node;
+        node->left = avl_node_weigh(list, lo, a, depth + 1);
+        node->right = avl_node_weigh(list, a + 1, hi, depth + 1);
+        return avl_node_update_height(node);
+}
+
+struct avl_tree *avl_reshape(struct avl_tree *tree, struct avl_stack *stack)
+{
+        struct avl_weight *list;
+        struct avl_node *node;
+        uint64_t total = 0;
+        size_t n = 0;
+        if(!tree->root) {
+                return tree;
+        } else if(tree->dead && !avl_compact(tree, stack)) {
+                return NULL;
+        }
+        list = malloc(tree->size * sizeof(struct avl_weight));
+        if(!list) {
+                return NULL;
+        } else if(!avl_traverse(tree, stack)) {
+                goto FAILURE;
+        }
+        while(n < tree->size && avl_next(stack, &node)) {
+                total += (uint64_t)node->hits + 1;
+                node->hits /= 2;
+                list[n].node = node;
+                list[n++].total = total;
+        }
+        assert(n == tree->size);
+        tree->root = avl_node_weigh(list, 0, n, 0);
+        tree->shaped = 1;
+        (void)free(list);
+        return tree;
+        FAILURE:
+        (void)free(list);
+        return NULL;
+}
+#endif
+
+#ifdef AVL_MERKLE
+uint64_t avl_digest_u64(struct avl_kv key, struct avl_kv value)
+{
+        return avl_hash_u64(AVL_KV(u64, avl_hash_u64(key) ^
+                ((value.u.u64 + 1) * 0x9e3779b97f4a7c15ULL)));
+}
+
+uint64_t avl_str_digest(struct avl_kv key, struct avl_kv value)
+{
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for(const unsigned char *c = key.u.ptr; *c; ++c) {
+                hash = (hash ^ *c) * 0x100000001b3ULL;
+        }
+        return avl_digest_u64(AVL_KV(u64, hash), value);
+}
+
+struct avl_tree *avl_tree_digest(struct avl_tree *tree, avl_digest_t digest)
+{
+        assert(tree && !tree->root && digest);
+        tree->digest = digest;
+        return tree;
+}
+
+struct avl_tree *avl_merkle_adjust(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node,
+        uint64_t digest)
+{
+        const uint64_t delta = digest - node->digest;
+        (void)avl_stack_reset(stack);
+        if(!avl_node_path(tree->root, stack, node, tree)) {
+                return NULL;
+        }
+        node->digest = digest;
+        node->merkle += delta;
+        (void)avl_stack_add_merkle(stack, 0, stack->size, delta);
+        return tree;
+}
+
+struct avl_tree *avl_merkle_update(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node)
+{
+        assert(node && !(node->height & AVL_DEAD));
+        return avl_merkle_adjust(
+                tree, stack, node, tree->digest(node->key, node->value));
+}
+
+uint64_t avl_merkle_hash(struct avl_tree *tree)
+{
+        return avl_node_merkle(tree->root);
+}
+
+uint64_t avl_merkle_sum(
+        struct avl_tree *tree,
+        struct avl_node *node,
+        uint64_t merkle,
+        struct avl_kv key,
+        const int inclusive)
+{
+        for(size_t I = 0; I < 2 * AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return merkle;
+                } else if(inclusive ? 
+                        !AVL_LESS(tree, key, node->key) :
+                        AVL_LESS(tree, node->key, key))
+                {
+                        merkle += avl_node_merkle(node->left) + node->digest;
+                        node = node->right;
+                } else {
                         node = node->left;
-                } else if(cmp(node->key,  key)) {
-                        if(!avl_stack_push(stack, node)) {
-                                return NULL;
-                        } else if(node->right == NULL) {
-                                return stack;
-                        }
+                }
+        }
+        assert(0);
+        return merkle;
+}
+
+uint64_t avl_merkle_below(
+        struct avl_tree *tree,
+        struct avl_kv key,
+        const int inclusive)
+{
+        return avl_merkle_sum(tree, tree->root, 0, key, inclusive);
+}
+
+uint64_t avl_merkle_range(
+        struct avl_tree *tree,
+        struct avl_kv lo,
+        struct avl_kv hi)
+{
+        return avl_merkle_below(tree, hi, 1) - avl_merkle_below(tree, lo, 0);
+}
+
+struct avl_node *avl_merkle_pivot(
+        struct avl_tree *tree,
+        struct avl_node *node,
+        uint64_t *base,
+        const struct avl_kv *lo,
+        const struct avl_kv *hi)
+{
+        for(size_t I = 0; I < 2 * AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return NULL;
+                } else if(lo && !AVL_LESS(tree, *lo, node->key)) {
+                        *base += avl_node_merkle(node->left) + node->digest;
                         node = node->right;
+                } else if(hi && !AVL_LESS(tree, node->key, *hi)) {
+                        node = node->left;
                 } else {
-                        if(!avl_stack_push(stack, node)) {
-                                return NULL;
-                        } 
-                        return stack;
+                        return node;
                 }
         }
         assert(0);
         return NULL;
 }
 
-struct avl_tree *avl_tree_init(
+struct avl_node *avl_merkle_split(
         struct avl_tree *tree,
-        avl_cmp_t cmp,
-        avl_alloc_t alloc,
-        avl_free_t free,
+        const struct avl_merkle_side *side,
+        const struct avl_kv *lo,
+        const struct avl_kv *hi,
+        const struct avl_kv *key,
+        struct avl_merkle_side *left,
+        struct avl_merkle_side *right)
+{
+        struct avl_node *node;
+        *left = *right = *side;
+        if(!side->pivot) {
+                return NULL;
+        }
+        left->hi = avl_merkle_sum(tree, side->pivot, side->base, *key, 0);
+        right->lo = avl_merkle_sum(tree, side->pivot, side->base, *key, 1);
+        left->pivot = avl_merkle_pivot(
+                tree, side->pivot, &left->base, lo, key);
+        right->pivot = avl_merkle_pivot(
+                tree, side->pivot, &right->base, key, hi);
+        node = avl_node_get(side->pivot, *key, tree);
+        return node && !(node->height & AVL_DEAD) ? node : NULL;
+}
+
+size_t avl_merkle_diff_span(
+        struct avl_tree *a,
+        struct avl_tree *b,
+        const struct avl_merkle_side *sa,
+        const struct avl_merkle_side *sb,
+        const struct avl_kv *lo,
+        const struct avl_kv *hi,
+        avl_diff_t visit,
         void *state)
 {
-        assert(tree);
-        tree->size = 0;
-        tree->root = NULL;
-        tree->cmp = cmp;
-        tree->alloc = alloc;
-        tree->free = free;
-        tree->heap = state;
+        struct avl_merkle_side la, ra, lb, rb;
+        struct avl_node *na, *nb;
+        struct avl_kv key;
+        size_t count = 0;
+        if(sa->hi - sa->lo == sb->hi - sb->lo) {
+                return 0;
+        }
+        assert(sa->pivot || sb->pivot);
+        key = sa->pivot ? sa->pivot->key : sb->pivot->key;
+        na = avl_merkle_split(a, sa, lo, hi, &key, &la, &ra);
+        nb = avl_merkle_split(b, sb, lo, hi, &key, &lb, &rb);
+        if(ra.lo - la.hi != rb.lo - lb.hi) {
+                count += 1;
+                if(visit) {
+                        visit(state, na, nb);
+                }
+        }
+        count += avl_merkle_diff_span(a, b, &la, &lb, lo, &key, visit, state);
+        count += avl_merkle_diff_span(a, b, &ra, &rb, &key, hi, visit, state);
+        return count;
+}
+
+size_t avl_merkle_diff(
+        struct avl_tree *a,
+        struct avl_tree *b,
+        avl_diff_t visit,
+        void *state)
+{
+        struct avl_merkle_side sa, sb;
+        assert(a && b);
+        sa.pivot = a->root;
+        sb.pivot = b->root;
+        sa.base = sa.lo = sb.base = sb.lo = 0;
+        sa.hi = avl_merkle_hash(a);
+        sb.hi = avl_merkle_hash(b);
+        return avl_merkle_diff_span(a, b, &sa, &sb, NULL, NULL, visit, state);
+}
+#endif
+
+struct avl_node *avl_tree_first(struct avl_tree *tree)
+{
+        struct avl_stack stack;
+        struct avl_node *node = NULL;
+        if(!tree->dead) {
+                return avl_node_min(tree->root);
+        } else if(!avl_traverse(tree, avl_stack_init(&stack))) {
+                return NULL;
+        }
+        return avl_next(&stack, &node) ? node : NULL;
+}
+
+struct avl_node *avl_tree_last(struct avl_tree *tree)
+{
+        struct avl_stack stack;
+        struct avl_node *node = NULL;
+        if(!tree->dead) {
+                return avl_node_max(tree->root);
+        } else if(!avl_reversed(tree, avl_stack_init(&stack))) {
+                return NULL;
+        }
+        return avl_prior(&stack, &node) ? node : NULL;
+}
+
+struct avl_node *avl_tree_linked(
+        struct avl_tree *tree,
+        struct avl_node *node)
+{
+        struct avl_stack stack;
+        if(tree->filter_hash && 
+                tree->size > AVL_FILTER_KEYS * tree->filter_blocks) 
+        {
+                (void)avl_filter_build(
+                        tree, avl_stack_init(&stack), tree->filter_hash);
+        } else if(tree->filter_hash) {
+                (void)avl_filter_insert(tree, node->key);
+        }
+        if(tree->hash) {
+                if(2 * tree->size > tree->index_size &&
+                        !avl_index_resize(tree, 2 * tree->index_size))
+                {
+                        (void)avl_tree_index(tree, NULL, NULL);
+                } else {
+                        (void)avl_index_insert(tree, node);
+                }
+        }
+        return node;
+}
+
+struct avl_tree *avl_tree_unlinked(
+        struct avl_tree *tree,
+        struct avl_node *node)
+{
+        struct avl_stack stack;
+        if(tree->hash) {
+                (void)avl_index_delete(tree, node);
+        }
+        if(tree->cache_hash && *avl_cache_slot(tree, node->key) == node) {
+                *avl_cache_slot(tree, node->key) = NULL;
+        }
+        if(tree->filter_hash && ++tree->filter_stale > tree->size) {
+                (void)avl_filter_build(
+                        tree, avl_stack_init(&stack), tree->filter_hash);
+        }
+        if(tree->min == node) {
+                tree->min = avl_tree_first(tree);
+        }
+        if(tree->max == node) {
+                tree->max = avl_tree_last(tree);
+        }
         return tree;
 }
 
-void avl_free_nodes(struct avl_tree *tree, struct avl_stack *stack)
+struct avl_tree *avl_tree_release(
+        struct avl_tree *tree,
+        struct avl_node *node,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
 {
-        struct avl_node *node;
-        (void)avl_stack_reset(stack);
-        avl_traverse(tree, stack);
-        for(size_t n = 0; n < tree->size; ++n) {
-                if(!avl_next(stack, &node)) {
-                        return;
+        if(node->height & AVL_DEAD) {
+                tree->dead -= 1;
+        } else {
+                tree->size -= 1;
+                (void)avl_tree_unlinked(tree, node);
+        }
+        if(rkey) {
+                *rkey = node->key;
+        }
+        if(rvalue) {
+                *rvalue = node->value;
+        }
+        (void)avl_tree_forget(tree, node);
+        AVL_STAT(tree, frees, 1);
+        tree->free(tree->heap, node);
+        return tree;
+}
+
+struct avl_tree *avl_tree_trim(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct avl_node *end, *result = node;
+        const int first = node == tree->min;
+        (void)avl_tree_settle(tree, stack);
+        tree->root = avl_node_remove_node(tree->root, stack, tree, &result);
+        if(!result) {
+                return NULL;
+        }
+        for(size_t n = tree->dead; n > 0; --n) {
+                end = first ? 
+                        avl_node_min(tree->root) : 
+                        avl_node_max(tree->root);
+                if(!end || !(end->height & AVL_DEAD)) {
+                        break;
                 }
-                tree->free(tree->heap, node);
+                tree->root = first ?
+                        avl_node_remove_first(tree->root, stack, &end, tree) :
+                        avl_node_remove_last(tree->root, stack, &end, tree);
+                assert(end);
+                (void)avl_tree_release(tree, end, NULL, NULL);
+        }
+        return avl_tree_release(tree, node, rkey, rvalue);
+}
+
+struct avl_tree *avl_tree_bury(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        assert(!(node->height & AVL_DEAD));
+        if(node == tree->min || node == tree->max) {
+                return avl_tree_trim(tree, stack, node, rkey, rvalue);
+        }
+        node->height |= AVL_DEAD;
+#ifdef AVL_MERKLE
+        (void)avl_merkle_adjust(tree, stack, node, 0);
+#endif
+        tree->size -= 1;
+        tree->dead += 1;
+        (void)avl_tree_unlinked(tree, node);
+        if(rkey) {
+                *rkey = node->key;
+        }
+        if(rvalue) {
+                *rvalue = node->value;
+        }
+        if(tree->dead > tree->size) {
+                (void)avl_compact(tree, stack);
+        }
+        return tree;
+}
+
+struct avl_node *avl_tree_revive(
+        struct avl_tree *tree,
+        struct avl_node *node,
+        struct avl_kv key,
+        struct avl_kv value)
+{
+        if(!(node->height & AVL_DEAD)) {
+                AVL_STAT(tree, failed_adds, 1);
+                return NULL;
+        }
+#ifdef AVL_MERKLE
+        struct avl_stack stack;
+#endif
+        node->height &= ~AVL_DEAD;
+        node->key = key;
+        node->value = value;
+#ifdef AVL_MERKLE
+        (void)avl_merkle_adjust(
+                tree, avl_stack_init(&stack), node, tree->digest(key, value));
+#endif
+        tree->dead -= 1;
+        tree->size += 1;
+        if(!tree->min || AVL_LESS(tree, node->key, tree->min->key)) {
+                tree->min = node;
+        }
+        if(!tree->max || AVL_LESS(tree, tree->max->key, node->key)) {
+                tree->max = node;
         }
+        return avl_tree_linked(tree, node);
 }
 
 struct avl_node *avl_add(
@@ -576,67 +2283,215 @@ struct avl_node *avl_add(
         struct avl_kv value)
 {
         struct avl_node *result = NULL;
+        if(tree->mode & AVL_LAZY) {
+                result = avl_node_get(tree->root, key, tree);
+                if(result) {
+                        return avl_tree_revive(tree, result, key, value);
+                }
+        }
+        (void)avl_tree_settle(tree, stack);
         tree->root = avl_node_add(
                 tree->root,
                 stack,  
                 key, 
                 value, 
-                tree->cmp, 
-                tree->alloc, 
-                tree->heap,
+                NULL,
+                tree,
                 &result);
         if(result) {
                 tree->size += 1;
-                return result;
+                return avl_tree_linked(tree, result);
+        } else {
+                AVL_STAT(tree, failed_adds, 1);
+                return NULL;
+        }
+}
+
+struct avl_tree *avl_remove(
+        struct avl_tree *tree, 
+        struct avl_stack *stack, 
+        struct avl_kv key, 
+        struct avl_kv *rkey, 
+        struct avl_kv *rvalue)
+{
+        struct avl_node *result = NULL;
+        if(tree->mode & AVL_LAZY) {
+                result = avl_get(tree, key);
+                if(!result) {
+                        return NULL;
+                }
+                return avl_tree_bury(tree, stack, result, rkey, rvalue);
+        }
+        (void)avl_tree_settle(tree, stack);
+        tree->root = avl_node_remove(
+                tree->root, 
+                stack,
+                key, 
+                tree, 
+                &result);
+        if(result) {
+                return avl_tree_release(tree, result, rkey, rvalue);
+        } else {
+                return NULL;
+        }
+}
+
+struct avl_node *avl_add_inline(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        const void *value)
+{
+        struct avl_node *node = avl_add(tree, stack, key, AVL_KV(u64, 0));
+        if(node && tree->value_size) {
+                (void)memcpy(avl_value(tree, node), value, tree->value_size);
+        }
+        return node;
+}
+
+struct avl_tree *avl_remove_inline(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        struct avl_kv *rkey,
+        void *rvalue)
+{
+        struct avl_node *result = NULL;
+        if(tree->mode & AVL_LAZY) {
+                result = avl_node_get(tree->root, key, tree);
+                if(!result || (result->height & AVL_DEAD)) {
+                        return NULL;
+                }
+        } else {
+                (void)avl_tree_settle(tree, stack);
+                tree->root = avl_node_remove(
+                        tree->root, stack, key, tree, &result);
+                if(!result) {
+                        return NULL;
+                }
+        }
+        if(rvalue && tree->value_size) {
+                (void)memcpy(rvalue, avl_value(tree, result), tree->value_size);
+        }
+        if(tree->mode & AVL_LAZY) {
+                return avl_tree_bury(tree, stack, result, rkey, NULL);
+        }
+        return avl_tree_release(tree, result, rkey, NULL);
+}
+
+struct avl_tree *avl_remove_node(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct avl_node *result = node;
+        if(tree->mode & AVL_LAZY) {
+                if(node->height & AVL_DEAD) {
+                        return NULL;
+                }
+                return avl_tree_bury(tree, stack, node, rkey, rvalue);
+        }
+        (void)avl_tree_settle(tree, stack);
+        tree->root = avl_node_remove_node(tree->root, stack, tree, &result);
+        if(result) {
+                return avl_tree_release(tree, result, rkey, rvalue);
         } else {
                 return NULL;
         }
 }
 
-struct avl_tree *avl_remove(
-        struct avl_tree *tree, 
-        struct avl_stack *stack, 
-        struct avl_kv key, 
-        struct avl_kv *rkey, 
-        struct avl_kv *rvalue)
+struct avl_node *avl_rekey(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_node *node,
+        struct avl_kv key)
+{
+        struct avl_node *other, *result = node;
+        assert(node && !(node->height & AVL_DEAD));
+        (void)avl_tree_settle(tree, stack);
+        (void)avl_tree_forget(tree, node);
+        if(!(tree->mode & AVL_MULTI)) {
+                other = avl_node_get(tree->root, key, tree);
+                if(other && other != node && !(other->height & AVL_DEAD)) {
+                        return NULL;
+                } else if(other && other != node) {
+                        tree->root = avl_node_remove_node(
+                                tree->root, stack, tree, &other);
+                        assert(other);
+                        (void)avl_tree_release(tree, other, NULL, NULL);
+                }
+        }
+        tree->root = avl_node_remove_node(tree->root, stack, tree, &result);
+        if(!result) {
+                return NULL;
+        }
+        tree->size -= 1;
+        (void)avl_tree_unlinked(tree, node);
+        tree->root = avl_node_add(
+                tree->root, stack, key, node->value, node, tree, &result);
+        assert(result == node);
+        tree->size += 1;
+        return avl_tree_linked(tree, node);
+}
+
+struct avl_node *avl_node_hit(
+        struct avl_tree *tree,
+        struct avl_node *node)
 {
-        struct avl_node *result = NULL;
-        tree->root = avl_node_remove(
-                tree->root, 
-                stack,
-                key, 
-                tree->cmp, 
-                &result);
-        if(result) {
-                tree->size -= 1;
-                if(rkey) {
-                        *rkey = result->key;
-                }
-                if(rvalue) {
-                        *rvalue = result->value;
-                }
-                tree->free(tree->heap, result);
-                return tree;
-        } else {
-                return NULL;
+        (void)tree;
+#ifdef AVL_COUNTS
+        if((tree->mode & AVL_TRACK_HITS) && node->hits < UINT_MAX) {
+                node->hits += 1;
         }
+#endif
+        return node;
 }
 
 struct avl_node *avl_get(
         struct avl_tree *tree, 
         struct avl_kv key)
 {
-        return avl_node_get(tree->root, key, tree->cmp);
+        struct avl_node *node, **slot = NULL;
+        if(tree->filter_hash && !avl_filter_test(tree, key)) {
+                return NULL;
+        } else if(tree->cache_hash) {
+                slot = avl_cache_slot(tree, key);
+                node = *slot;
+                if(node && !AVL_LESS(tree, key, node->key) &&
+                        !AVL_LESS(tree, node->key, key))
+                {
+                        return avl_node_hit(tree, node);
+                }
+        }
+        node = tree->hash ? 
+                avl_index_get(tree, key) : 
+                avl_node_get(tree->root, key, tree);
+        if(!node || (node->height & AVL_DEAD)) {
+                return NULL;
+        } else if(slot) {
+                *slot = node;
+        }
+        return avl_node_hit(tree, node);
+}
+
+void *avl_value(struct avl_tree *tree, struct avl_node *node)
+{
+        if(!tree->value_size) {
+                return NULL;
+        }
+        return (char *)node + (tree->node_size - tree->value_size);
 }
 
 struct avl_node *avl_min(struct avl_tree *tree)
 {
-        return avl_node_min(tree->root);
+        return tree->min;
 }
 
 struct avl_node *avl_max(struct avl_tree *tree)
 {
-        return avl_node_max(tree->root);
+        return tree->max;
 }
 
 struct avl_stack *avl_reversed(
@@ -686,20 +2541,19 @@ struct avl_tree *avl_remove_min(
         struct avl_kv *rvalue)
 {
         struct avl_node *result = NULL;
-        tree->root = avl_node_remove_first(tree->root, stack, &result);
-        if(result) {
-                tree->size -= 1;
-                if(rkey) {
-                        *rkey = result->key;
-                }
-                if(rvalue) {
-                        *rvalue = result->value;
+        (void)avl_tree_settle(tree, stack);
+        const size_t ndead = tree->dead;
+        for(size_t n = 0; n <= ndead; ++n) {
+                tree->root = avl_node_remove_first(
+                        tree->root, stack, &result, tree);
+                if(!result) {
+                        return NULL;
+                } else if(!(result->height & AVL_DEAD)) {
+                        return avl_tree_release(tree, result, rkey, rvalue);
                 }
-                tree->free(tree->heap, result);
-                return tree;
-        } else {
-                return NULL;
+                (void)avl_tree_release(tree, result, NULL, NULL);
         }
+        return NULL;
 }
 
 struct avl_tree *avl_remove_max(
@@ -709,56 +2563,171 @@ struct avl_tree *avl_remove_max(
         struct avl_kv *rvalue)
 {
         struct avl_node *result = NULL;
-        tree->root = avl_node_remove_last(tree->root, stack, &result);
-        if(result) {
-                tree->size -= 1;
-                if(rkey) {
-                        *rkey = result->key;
-                }
-                if(rvalue) {
-                        *rvalue = result->value;
+        (void)avl_tree_settle(tree, stack);
+        const size_t ndead = tree->dead;
+        for(size_t n = 0; n <= ndead; ++n) {
+                tree->root = avl_node_remove_last(
+                        tree->root, stack, &result, tree);
+                if(!result) {
+                        return NULL;
+                } else if(!(result->height & AVL_DEAD)) {
+                        return avl_tree_release(tree, result, rkey, rvalue);
                 }
-                tree->free(tree->heap, result);
-                return tree;
+                (void)avl_tree_release(tree, result, NULL, NULL);
+        }
+        return NULL;
+}
+
+size_t avl_tree_drop(
+        struct avl_tree *tree,
+        struct avl_node *node,
+        avl_visit_t visit,
+        void *state)
+{
+        (void)avl_tree_forget(tree, node);
+        if(node->height & AVL_DEAD) {
+                tree->dead -= 1;
+                AVL_STAT(tree, frees, 1);
+                tree->free(tree->heap, node);
+                return 0;
+        }
+        tree->size -= 1;
+        (void)avl_tree_unlinked(tree, node);
+        if(visit) {
+                visit(state, node);
         } else {
-                return NULL;
+                AVL_STAT(tree, frees, 1);
+                tree->free(tree->heap, node);
+        }
+        return 1;
+}
+
+size_t avl_tree_cut_each(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        const struct avl_kv *lo,
+        const int lo_keep,
+        const struct avl_kv *hi,
+        const int hi_keep,
+        avl_visit_t visit,
+        void *state)
+{
+        struct avl_node *node;
+        size_t removed = 0;
+        const size_t total = tree->size + tree->dead;
+        for(size_t n = 0; n < total; ++n) {
+                node = lo ? avl_node_after(tree->root, *lo, lo_keep, tree)
+                        : avl_node_min(tree->root);
+                if(!node || (hi &&
+                        !avl_node_before(tree, node, *hi, !hi_keep)))
+                {
+                        break;
+                }
+                tree->root = avl_node_remove_node(
+                        tree->root, stack, tree, &node);
+                assert(node);
+                removed += avl_tree_drop(tree, node, visit, state);
+        }
+        return removed;
+}
+
+size_t avl_tree_cut(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        const struct avl_kv *lo,
+        const int lo_keep,
+        const struct avl_kv *hi,
+        const int hi_keep,
+        avl_visit_t visit,
+        void *state)
+{
+        struct avl_node *below = NULL, *range, *above = NULL;
+        struct avl_node *node;
+        size_t removed = 0, total;
+        (void)avl_tree_settle(tree, stack);
+        range = tree->root;
+        total = tree->size + tree->dead;
+        if(tree->mode & AVL_WAVL) {
+                return avl_tree_cut_each(
+                        tree, stack, lo, lo_keep, hi, hi_keep, visit, state);
+        }
+        if(lo) {
+                (void)avl_node_split(
+                        tree->root, *lo, lo_keep, &below, &range, tree);
+        }
+        if(hi) {
+                (void)avl_node_split(
+                        range, *hi, !hi_keep, &range, &above, tree);
         }
+        tree->root = avl_node_concat(below, above, tree);
+        if(!avl_node_traverse(range, stack)) {
+                return 0;
+        }
+        for(size_t n = 0; n < total; ++n) {
+                if(!avl_step_next(stack, &node)) {
+                        break;
+                }
+                removed += avl_tree_drop(tree, node, visit, state);
+        }
+        return removed;
+}
+
+size_t avl_remove_range(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv lo,
+        struct avl_kv hi,
+        avl_visit_t visit,
+        void *state)
+{
+        if(AVL_LESS(tree, hi, lo)) {
+                return 0;
+        }
+        return avl_tree_cut(tree, stack, &lo, 0, &hi, 0, visit, state);
+}
+
+size_t avl_truncate_below(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        avl_visit_t visit,
+        void *state)
+{
+        return avl_tree_cut(tree, stack, NULL, 0, &key, 1, visit, state);
+}
+
+size_t avl_truncate_above(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key,
+        avl_visit_t visit,
+        void *state)
+{
+        return avl_tree_cut(tree, stack, &key, 1, NULL, 0, visit, state);
 }
 
 int avl_next(
         struct avl_stack *stack,
         struct avl_node **result)
 {
-        struct avl_node *node = avl_stack_pop(stack);
-        if(!node) {
-                return 0;
-        } else if(node->right) {
-                for(struct avl_node *n = node->right; n; n = n->left) {
-                        if(!avl_stack_push(stack, n)) {
-                                return 0;
-                        }
+        while(avl_step_next(stack, result)) {
+                if(!((*result)->height & AVL_DEAD)) {
+                        return 1;
                 }
         }
-        *result = node;
-        return 1;
+        return 0;
 }
 
 int avl_prior(
         struct avl_stack *stack,
         struct avl_node **result)
 {
-        struct avl_node *node = avl_stack_pop(stack);
-        if(!node) {
-                return 0;
-        } else if(node->left) {
-                for(struct avl_node *n = node->left; n; n = n->right) {
-                        if(!avl_stack_push(stack, n)) {
-                                return 0;
-                        }
+        while(avl_step_prior(stack, result)) {
+                if(!((*result)->height & AVL_DEAD)) {
+                        return 1;
                 }
         }
-        *result = node;
-        return 1;
+        return 0;
 }
 
 struct avl_stack *avl_upper(
@@ -766,7 +2735,10 @@ struct avl_stack *avl_upper(
         struct avl_stack *stack,
         struct avl_kv key)
 {
-        return avl_node_upper(tree->root, stack, key, tree->cmp);
+        struct avl_str_key str;
+        const void *probe;
+        const avl_step_t step = avl_tree_probe(tree, &key, &str, &probe);
+        return avl_node_upper(tree->root, stack, step, probe, tree);
 }
 
 struct avl_stack *avl_lower(
@@ -774,5 +2746,302 @@ struct avl_stack *avl_lower(
         struct avl_stack *stack,
         struct avl_kv key)
 {
-        return avl_node_lower(tree->root, key, tree->cmp, stack);
-}
\ No newline at end of file
+        struct avl_str_key str;
+        const void *probe;
+        const avl_step_t step = avl_tree_probe(tree, &key, &str, &probe);
+        return avl_node_lower(tree->root, step, probe, tree, stack);
+}
+
+struct avl_stack *avl_equal_range(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key)
+{
+        struct avl_node *node;
+        struct avl_str_key str;
+        const void *probe;
+        const avl_step_t step = avl_tree_probe(tree, &key, &str, &probe);
+        if(!avl_node_upper(tree->root, stack, step, probe, tree)) {
+                return NULL;
+        } 
+        node = avl_stack_peek(stack);
+        if(node && step(tree, probe, node) < 0) {
+                return avl_stack_reset(stack);
+        }
+        return stack;
+}
+
+size_t avl_count(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        struct avl_kv key)
+{
+        struct avl_node *node;
+        struct avl_str_key str;
+        const void *probe;
+        const avl_step_t step = avl_tree_probe(tree, &key, &str, &probe);
+        size_t count = 0;
+        if(!avl_equal_range(tree, stack, key)) {
+                return 0;
+        }
+        while(avl_next(stack, &node) && !step(tree, probe, node)) {
+                count += 1;
+        }
+        return count;
+}
+
+int avl_str_cmp(struct avl_kv a, struct avl_kv b)
+{
+        return strcmp(a.u.ptr, b.u.ptr) < 0;
+}
+
+struct avl_tree *avl_str_tree_init(
+        struct avl_tree *tree,
+        avl_alloc_t alloc,
+        avl_free_t free,
+        void *state)
+{
+        (void)avl_tree_init(tree, avl_str_cmp, alloc, free, state);
+        tree->node_size = sizeof(struct avl_str_node);
+        tree->mode = AVL_STR;
+#ifdef AVL_MERKLE
+        tree->digest = avl_str_digest;
+#endif
+        return tree;
+}
+
+struct avl_node *avl_str_node_get(
+        struct avl_node *node,
+        const struct avl_str_key *str,
+        struct avl_tree *tree)
+{
+        (void)tree;
+        int order;
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return NULL;
+                } 
+                AVL_STAT(tree, compares, 1);
+                order = avl_str_order(str, node);
+                if(order < 0) {
+                        node = node->left;
+                } else if(order > 0) {
+                        node = node->right;
+                } else {
+                        return node;
+                }
+        }
+        assert(0);
+        return NULL;
+}
+
+struct avl_node *avl_str_add(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        const char *key,
+        size_t length,
+        struct avl_kv value)
+{
+        struct avl_str_key str;
+        struct avl_node *result = NULL;
+        (void)avl_str_key_init(&str, key, length);
+        if(tree->mode & AVL_LAZY) {
+                result = avl_str_node_get(tree->root, &str, tree);
+                if(result) {
+                        return avl_tree_revive(
+                                tree, result, AVL_KV(ptr, (void*)key), value);
+                }
+        }
+        (void)avl_tree_settle(tree, stack);
+        tree->root = avl_node_insert(tree->root, stack, avl_str_step, &str,
+                AVL_KV(ptr, (void*)key), value, NULL, tree, &result);
+        if(result) {
+                tree->size += 1;
+                return avl_tree_linked(tree, result);
+        } else {
+                AVL_STAT(tree, failed_adds, 1);
+                return NULL;
+        }
+}
+
+struct avl_tree *avl_str_remove(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        const char *key,
+        size_t length,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct avl_str_key str;
+        struct avl_node *result = NULL;
+        if(tree->mode & AVL_LAZY) {
+                result = avl_str_get(tree, key, length);
+                if(!result) {
+                        return NULL;
+                }
+                return avl_tree_bury(tree, stack, result, rkey, rvalue);
+        }
+        (void)avl_tree_settle(tree, stack);
+        tree->root = avl_node_delete(tree->root, stack, avl_str_step,
+                avl_str_key_init(&str, key, length), tree, &result);
+        if(result) {
+                return avl_tree_release(tree, result, rkey, rvalue);
+        } else {
+                return NULL;
+        }
+}
+
+struct avl_node *avl_str_get(
+        struct avl_tree *tree,
+        const char *key,
+        size_t length)
+{
+        struct avl_str_key str;
+        struct avl_node *node = avl_str_node_get(
+                tree->root, avl_str_key_init(&str, key, length), tree);
+        if(node && (node->height & AVL_DEAD)) {
+                return NULL;
+        }
+        return node;
+}
+
+struct avl_merge *avl_merge_init(
+        struct avl_merge *merge,
+        unsigned int policy,
+        int reversed)
+{
+        assert(merge && policy <= AVL_MERGE_LAST);
+        merge->count = 0;
+        merge->size = 0;
+        merge->policy = policy;
+        merge->reversed = reversed;
+        return merge;
+}
+
+int avl_merge_before(struct avl_merge *merge, size_t a, size_t b)
+{
+        struct avl_tree *tree = merge->trees[0];
+        struct avl_kv ka = merge->heads[a]->key;
+        struct avl_kv kb = merge->heads[b]->key;
+        if(merge->reversed ? 
+                AVL_LESS(tree, kb, ka) : 
+                AVL_LESS(tree, ka, kb))
+        {
+                return 1;
+        } else if(merge->reversed ? 
+                AVL_LESS(tree, ka, kb) : 
+                AVL_LESS(tree, kb, ka))
+        {
+                return 0;
+        }
+        return a < b;
+}
+
+void avl_merge_sift_up(struct avl_merge *merge, size_t n)
+{
+        const size_t source = merge->heap[n];
+        for(size_t I = 0; I < AVL_MERGE_MAX && n; ++I) {
+                const size_t parent = (n - 1) / 2;
+                if(!avl_merge_before(merge, source, merge->heap[parent])) {
+                        break;
+                }
+                merge->heap[n] = merge->heap[parent];
+                n = parent;
+        }
+        merge->heap[n] = source;
+}
+
+void avl_merge_sift_down(struct avl_merge *merge, size_t n)
+{
+        const size_t source = merge->heap[n];
+        for(size_t I = 0; I < AVL_MERGE_MAX; ++I) {
+                size_t child = 2 * n + 1;
+                if(child >= merge->size) {
+                        break;
+                } else if(child + 1 < merge->size && avl_merge_before(
+                        merge, merge->heap[child + 1], merge->heap[child]))
+                {
+                        child += 1;
+                }
+                if(!avl_merge_before(merge, merge->heap[child], source)) {
+                        break;
+                }
+                merge->heap[n] = merge->heap[child];
+                n = child;
+        }
+        merge->heap[n] = source;
+}
+
+int avl_merge_step(struct avl_merge *merge, size_t source)
+{
+        return merge->reversed ?
+                avl_prior(merge->stacks[source], &merge->heads[source]) :
+                avl_next(merge->stacks[source], &merge->heads[source]);
+}
+
+struct avl_merge *avl_merge_add(
+        struct avl_merge *merge,
+        struct avl_tree *tree,
+        struct avl_stack *stack)
+{
+        const size_t source = merge->count;
+        if(source == AVL_MERGE_MAX) {
+                return NULL;
+        }
+        merge->trees[source] = tree;
+        merge->stacks[source] = stack;
+        merge->count += 1;
+        if(avl_merge_step(merge, source)) {
+                merge->heap[merge->size] = source;
+                merge->size += 1;
+                (void)avl_merge_sift_up(merge, merge->size - 1);
+        }
+        return merge;
+}
+
+size_t avl_merge_pop(struct avl_merge *merge)
+{
+        const size_t source = merge->heap[0];
+        if(avl_merge_step(merge, source)) {
+                (void)avl_merge_sift_down(merge, 0);
+        } else {
+                merge->size -= 1;
+                merge->heap[0] = merge->heap[merge->size];
+                if(merge->size) {
+                        (void)avl_merge_sift_down(merge, 0);
+                }
+        }
+        return source;
+}
+
+int avl_merge_next(
+        struct avl_merge *merge,
+        struct avl_node **result,
+        size_t *source)
+{
+        struct avl_tree *tree = merge->trees[0];
+        size_t top;
+        if(!merge->size) {
+                return 0;
+        }
+        top = merge->heap[0];
+        *result = merge->heads[top];
+        (void)avl_merge_pop(merge);
+        while(merge->policy != AVL_MERGE_ALL && merge->size) {
+                const struct avl_node *next = merge->heads[merge->heap[0]];
+                if(merge->reversed ?
+                        AVL_LESS(tree, next->key, (*result)->key) :
+                        AVL_LESS(tree, (*result)->key, next->key))
+                {
+                        break;
+                } else if(merge->policy == AVL_MERGE_LAST) {
+                        top = merge->heap[0];
+                        *result = merge->heads[top];
+                }
+                (void)avl_merge_pop(merge);
+        }
+        if(source) {
+                *source = top;
+        }
+        return 1;
+}
@@ -79,16 +79,18 @@ class AVLNode {
         }
 
         /** Add a <key,value> pair to the tree. */
-        static add(node, key, val, result) 
+        static add(node, key, val, result, multi) 
         {
                 if(node === null) {
                         result.node = new AVLNode(key, val);
                         return result.node;
                 } else if(key < node.key) {
-                        node.left = AVLNode.add(node.left, key, val, result);
+                        node.left = AVLNode.add(
+                                node.left, key, val, result, multi);
                         return node.updateHeight().rebalance();
-                } else if(node.key < key) {
-                        node.right = AVLNode.add(node.right, key, val, result);
+                } else if(multi || node.key < key) {
+                        node.right = AVLNode.add(
+                                node.right, key, val, result, multi);
                         return node.updateHeight().rebalance();
                 } else {
                         return node;
@@ -159,6 +161,28 @@ class AVLNode {
                 }
         }
 
+        /** Remove the target node from the tree. */
+        static removeNode(node, target, result) 
+        {
+                if(node === null) {
+                        return null;
+                } else if(node === target) {
+                        result.node = node;
+                        return AVLNode.pluck(node);
+                } else if(target.key < node.key) {
+                        node.left = AVLNode.removeNode(node.left, target, result);
+                } else if(node.key < target.key) {
+                        node.right = AVLNode.removeNode(node.right, target, result);
+                } else {
+                        node.left = AVLNode.removeNode(node.left, target, result);
+                        if(result.node === undefined) {
+                                node.right = AVLNode.removeNode(
+                                        node.right, target, result);
+                        }
+                }
+                return node.updateHeight().rebalance();
+        }
+
         /** Get the minimum value starting from the given node. */
         static min(node) 
         {
@@ -208,71 +232,61 @@ class AVLNode {
         }
 
         /** An iterator from the first element greater or equal to key. */ 
-        static upper(node, key) 
+        static upper(node, key, multi) 
         {
                 const iter = new AVLIterator(null);
-                for(;;) {
-                        if(key < node.key) {
+                for(;node !== null;) {
+                        if(node.key < key) {
+                                node = node.right;
+                        } else {
                                 iter.stack.push(node);
-                                if(node.left === null) {
-                                        return iter;
-                                } else {
+                                if(multi || key < node.key) {
                                         node = node.left;
-                                }
-                        } else if(node.key < key) {
-                                if(node.right === null) {
-                                        return iter;
                                 } else {
-                                        node = node.right;
+                                        return iter;
                                 }
-                        } else {
-                                iter.stack.push(node);
-                                return iter;
                         }
                 }
+                return iter;
         }
 
         /** An iterator from the first element less than or equal to key. */
-        static lower(node, key) 
+        static lower(node, key, multi) 
         {
                 const iter = new AVLIteratorReversed(null);
-                for(;;) {
+                for(;node !== null;) {
                         if(key < node.key) {
-                                if(node.left === null) {
-                                        return iter;
-                                } else {
-                                        node = node.left;
-                                }
-                        } else if(node.key < key) {
+                                node = node.left;
+                        } else {
                                 iter.stack.push(node);
-                                if(node.right === null) {
-                                        return iter;
-                                } else {
+                                if(multi || node.key < key) {
                                         node = node.right;
+                                } else {
+                                        return iter;
                                 }
-                        } else {
-                                iter.stack.push(node);
-                                return iter;
                         }
                 }
+                return iter;
         }
 }
 
 /** Balanced Search Tree */
 class AVLTree {
 
-        /** Create a new AVLTree */
-        constructor() 
+        /** Create a new AVLTree, allowing duplicate keys if options.multi */
+        constructor(options) 
         {
                 this.root = null;
                 this.size = 0;
+                this.multi = options !== undefined && options.multi === true;
         }
 
         /** Add a new entry unless it already exists. */
         add(key, value) 
         {
                 const result = { };
-                this.root = AVLNode.add(this.root, key, value, result);
+                this.root = AVLNode.add(
+                        this.root, key, value, result, this.multi);
                 if(result.node !== undefined) {
                         this.size += 1;
                         return result.node;
@@ -298,6 +312,23 @@ class AVLTree {
                 }
         }
 
+        /** Remove the given node from the tree. */
+        removeNode(node, result) 
+        {
+                const arg = { };
+                this.root = AVLNode.removeNode(this.root, node, arg);
+                if(arg.node !== undefined) {
+                        this.size -= 1;
+                        if(result) {
+                                result.key = arg.node.key;
+                                result.value = arg.node.value;
+                        }
+                        return this;
+                } else {
+                        return null;
+                }
+        }
+
         /** Get the key's node if it exists. */
         get(key) 
         {
@@ -373,13 +404,29 @@ class AVLTree {
         /** Get an iterator from the first element equal to or larger than key. */
         upper(key) 
         {
-                return AVLNode.upper(this.root, key);
+                return AVLNode.upper(this.root, key, this.multi);
         }
 
         /** Get a reverse iterator from the first element equal to or less than key. */
         lower(key) 
         {
-                return AVLNode.lower(this.root, key);
+                return AVLNode.lower(this.root, key, this.multi);
+        }
+
+        /** Get an iterator over the entries equal to key. */
+        equal(key) 
+        {
+                return new AVLIteratorEqual(this.upper(key), key);
+        }
+
+        /** Count the entries equal to key. */
+        count(key) 
+        {
+                let count = 0;
+                for(const node of this.equal(key)) {
+                        count += 1;
+                }
+                return count;
         }
 }
 
@@ -437,4 +484,741 @@ class AVLIteratorReversed {
         {
                 return this;
         }
-};
\ No newline at end of file
+};
+
+/** Iterator over the entries equal to key, from an iterator at its first */
+class AVLIteratorEqual {
+        constructor(iter, key) 
+        {
+                this.iter = iter;
+                this.key = key;
+        }
+
+        next() 
+        {
+                const result = this.iter.next();
+                if(result.done || this.key < result.value.key) {
+                        return { done: true };
+                } 
+                return result;
+        }
+
+        [Symbol.iterator]() 
+        {
+                return this;
+        }
+};
+
+/**
+ * Balanced Search Tree of numbers stored in typed arrays. Unlike AVLTree,
+ * nodes are integer handles into the arrays (0 is none): add, get and the
+ * iterators yield handles, key and value read them, and keys are unique.
+ */
+class AVLArrayTree {
+
+        /** Create a new AVLArrayTree with room for options.capacity nodes. */
+        constructor(options) 
+        {
+                if(options !== undefined && options.multi === true) {
+                        throw new RangeError("AVLArrayTree keys are unique");
+                }
+                const capacity = options !== undefined && options.capacity > 0 ?
+                        options.capacity : 16;
+                this.keys = new Float64Array(capacity + 1);
+                this.values = new Float64Array(capacity + 1);
+                this.left = new Int32Array(capacity + 1);
+                this.right = new Int32Array(capacity + 1);
+                this.height = new Int32Array(capacity + 1);
+                this.root = 0;
+                this.size = 0;
+                this.free = 0;
+                this.next = 1;
+                this.found = 0;
+                this.succ = 0;
+        }
+
+        /** Get the number of nodes the buffers can hold. */
+        get capacity() 
+        {
+                return this.keys.length - 1;
+        }
+
+        /** Double the size of every buffer. */
+        grow() 
+        {
+                const length = 2 * this.keys.length;
+                const resize = (Type, array) => {
+                        const result = new Type(length);
+                        result.set(array);
+                        return result;
+                };
+                this.keys = resize(Float64Array, this.keys);
+                this.values = resize(Float64Array, this.values);
+                this.left = resize(Int32Array, this.left);
+                this.right = resize(Int32Array, this.right);
+                this.height = resize(Int32Array, this.height);
+        }
+
+        /** Take a node from the free list, or from the end of the buffers. */
+        alloc(key, value) 
+        {
+                let node = this.free;
+                if(node !== 0) {
+                        this.free = this.left[node];
+                } else {
+                        if(this.next === this.keys.length) {
+                                this.grow();
+                        }
+                        node = this.next++;
+                }
+                this.keys[node] = key;
+                this.values[node] = value;
+                this.left[node] = 0;
+                this.right[node] = 0;
+                this.height[node] = 1;
+                return node;
+        }
+
+        /** Return a node to the free list. */
+        release(node) 
+        {
+                this.left[node] = this.free;
+                this.height[node] = 0;
+                this.free = node;
+        }
+
+        /** Recompute the node's height. */
+        updateHeight(node) 
+        {
+                const hl = this.height[this.left[node]];
+                const hr = this.height[this.right[node]];
+                this.height[node] = 1 + (hl < hr ? hr : hl);
+                return node;
+        }
+
+        /** Get the node's balance factor. */
+        balanceFactor(node) 
+        {
+                return this.height[this.right[node]] - 
+                        this.height[this.left[node]];
+        }
+
+        /** Rotate the node to the right. */
+        rotateRight(node) 
+        {
+                const x = this.left[node];
+                this.left[node] = this.right[x];
+                this.right[x] = node;
+                this.updateHeight(node);
+                return this.updateHeight(x);
+        }
+
+        /** Rotate the node to the left. */
+        rotateLeft(node) 
+        {
+                const y = this.right[node];
+                this.right[node] = this.left[y];
+                this.left[y] = node;
+                this.updateHeight(node);
+                return this.updateHeight(y);
+        }
+
+        /** Update the node's height and rebalance it. */
+        rebalance(node) 
+        {
+                const balance = this.balanceFactor(this.updateHeight(node));
+                if(balance > 1) {
+                        if(this.balanceFactor(this.right[node]) < 0) {
+                                this.right[node] = 
+                                        this.rotateRight(this.right[node]);
+                        }
+                        return this.rotateLeft(node);
+                } else if(balance < -1) {
+                        if(this.balanceFactor(this.left[node]) > 0) {
+                                this.left[node] = 
+                                        this.rotateLeft(this.left[node]);
+                        }
+                        return this.rotateRight(node);
+                } else {
+                        return node;
+                }
+        }
+
+        /** Helper function for AVLArrayTree.add. */
+        insert(node, key, value) 
+        {
+                if(node === 0) {
+                        return this.found = this.alloc(key, value);
+                } else if(key < this.keys[node]) {
+                        const left = this.insert(this.left[node], key, value);
+                        this.left[node] = left;
+                } else if(this.keys[node] < key) {
+                        const right = this.insert(this.right[node], key, value);
+                        this.right[node] = right;
+                } else {
+                        return node;
+                }
+                return this.rebalance(node);
+        }
+
+        /** Helper function for AVLArrayTree.pluck. */
+        pluckMin(node) 
+        {
+                if(this.left[node] !== 0) {
+                        this.left[node] = this.pluckMin(this.left[node]);
+                        return this.rebalance(node);
+                } else {
+                        this.succ = node;
+                        return this.right[node];
+                }
+        }
+
+        /** Unlink the node, returning its replacement. */
+        pluck(node) 
+        {
+                if(this.left[node] === 0) {
+                        return this.right[node];
+                } else if(this.right[node] === 0) {
+                        return this.left[node];
+                } else {
+                        const right = this.pluckMin(this.right[node]);
+                        const succ = this.succ;
+                        this.left[succ] = this.left[node];
+                        this.right[succ] = right;
+                        return this.rebalance(succ);
+                }
+        }
+
+        /** Helper function for AVLArrayTree.remove. */
+        delete(node, key) 
+        {
+                if(node === 0) {
+                        return 0;
+                } else if(key < this.keys[node]) {
+                        this.left[node] = this.delete(this.left[node], key);
+                } else if(this.keys[node] < key) {
+                        this.right[node] = this.delete(this.right[node], key);
+                } else {
+                        this.found = node;
+                        return this.pluck(node);
+                }
+                return this.rebalance(node);
+        }
+
+        /** Helper function for AVLArrayTree.removeMin. */
+        deleteMin(node) 
+        {
+                if(this.left[node] !== 0) {
+                        this.left[node] = this.deleteMin(this.left[node]);
+                        return this.rebalance(node);
+                } else {
+                        this.found = node;
+                        return this.right[node];
+                }
+        }
+
+        /** Helper function for AVLArrayTree.removeMax. */
+        deleteMax(node) 
+        {
+                if(this.right[node] !== 0) {
+                        this.right[node] = this.deleteMax(this.right[node]);
+                        return this.rebalance(node);
+                } else {
+                        this.found = node;
+                        return this.left[node];
+                }
+        }
+
+        /** Release the found node after copying its entry into result. */
+        unlink(result) 
+        {
+                const node = this.found;
+                this.found = 0;
+                if(node === 0) {
+                        return null;
+                } else if(result) {
+                        result.key = this.keys[node];
+                        result.value = this.values[node];
+                }
+                this.release(node);
+                this.size -= 1;
+                return this;
+        }
+
+        /** Add a new entry unless it exists, returning its node or 0. */
+        add(key, value) 
+        {
+                this.found = 0;
+                this.root = this.insert(this.root, key, value);
+                const node = this.found;
+                if(node !== 0) {
+                        this.found = 0;
+                        this.size += 1;
+                }
+                return node;
+        }
+
+        /** Remove the entry with the given key. */
+        remove(key, result) 
+        {
+                this.root = this.delete(this.root, key);
+                return this.unlink(result);
+        }
+
+        /** Remove the given node from the tree. */
+        removeNode(node, result) 
+        {
+                if(node === 0 || this.get(this.keys[node]) !== node) {
+                        return null;
+                }
+                return this.remove(this.keys[node], result);
+        }
+
+        /** Remove the first entry. */
+        removeMin(result) 
+        {
+                if(this.root !== 0) {
+                        this.root = this.deleteMin(this.root);
+                }
+                return this.unlink(result);
+        }
+
+        /** Remove the last entry. */
+        removeMax(result) 
+        {
+                if(this.root !== 0) {
+                        this.root = this.deleteMax(this.root);
+                }
+                return this.unlink(result);
+        }
+
+        /** Get the key's node, or 0 if it does not exist. */
+        get(key) 
+        {
+                let node = this.root;
+                while(node !== 0) {
+                        const k = this.keys[node];
+                        if(key < k) {
+                                node = this.left[node];
+                        } else if(k < key) {
+                                node = this.right[node];
+                        } else {
+                                return node;
+                        }
+                }
+                return 0;
+        }
+
+        /** Get the node's key. */
+        key(node) 
+        {
+                return this.keys[node];
+        }
+
+        /** Get the node's value. */
+        value(node) 
+        {
+                return this.values[node];
+        }
+
+        /** Replace the node's value. */
+        setValue(node, value) 
+        {
+                this.values[node] = value;
+                return this;
+        }
+
+        /** Get the tree's minimum node. */
+        min() 
+        {
+                let node = this.root;
+                while(this.left[node] !== 0) {
+                        node = this.left[node];
+                }
+                return node;
+        }
+
+        /** Get the tree's maximum node. */
+        max() 
+        {
+                let node = this.root;
+                while(this.right[node] !== 0) {
+                        node = this.right[node];
+                }
+                return node;
+        }
+
+        /** Get an iterator that traverses the tree in reversed order. */
+        reversed() 
+        {
+                return new AVLArrayIterator(this, true).push(this.root);
+        }
+
+        /** Get the default iterator. */
+        [Symbol.iterator]() 
+        {
+                return new AVLArrayIterator(this, false).push(this.root);
+        }
+
+        /** Get an iterator from the first element equal to or larger than key. */
+        upper(key) 
+        {
+                const iter = new AVLArrayIterator(this, false);
+                let node = this.root;
+                while(node !== 0) {
+                        const k = this.keys[node];
+                        if(k < key) {
+                                node = this.right[node];
+                        } else {
+                                iter.stack[iter.depth++] = node;
+                                if(key < k) {
+                                        node = this.left[node];
+                                } else {
+                                        break;
+                                }
+                        }
+                }
+                return iter;
+        }
+
+        /** Get a reverse iterator from the first element equal to or less than key. */
+        lower(key) 
+        {
+                const iter = new AVLArrayIterator(this, true);
+                let node = this.root;
+                while(node !== 0) {
+                        const k = this.keys[node];
+                        if(key < k) {
+                                node = this.left[node];
+                        } else {
+                                iter.stack[iter.depth++] = node;
+                                if(k < key) {
+                                        node = this.right[node];
+                                } else {
+                                        break;
+                                }
+                        }
+                }
+                return iter;
+        }
+
+        /** Get an iterator over the node equal to key, if any. */
+        equal(key) 
+        {
+                return new AVLArrayIteratorEqual(this.upper(key), key);
+        }
+
+        /** Count the entries equal to key. */
+        count(key) 
+        {
+                return this.get(key) === 0 ? 0 : 1;
+        }
+}
+
+/** Iterator over an AVLArrayTree's nodes that reuses its result object */
+class AVLArrayIterator {
+        constructor(tree, reversed) 
+        {
+                this.tree = tree;
+                this.reversed = reversed;
+                this.stack = new Int32Array(64);
+                this.depth = 0;
+                this.result = { value: 0, done: false };
+        }
+
+        /** Push the node and its leading spine. */
+        push(node) 
+        {
+                const next = this.reversed ? this.tree.right : this.tree.left;
+                for(; node !== 0; node = next[node]) {
+                        this.stack[this.depth++] = node;
+                }
+                return this;
+        }
+
+        next() 
+        {
+                if(this.depth === 0) {
+                        this.result.value = 0;
+                        this.result.done = true;
+                } else {
+                        const node = this.stack[--this.depth];
+                        this.push(this.reversed ? 
+                                this.tree.left[node] : this.tree.right[node]);
+                        this.result.value = node;
+                }
+                return this.result;
+        }
+
+        [Symbol.iterator]() 
+        {
+                return this;
+        }
+};
+
+/** Iterator over an AVLArrayTree's nodes equal to key, from its upper */
+class AVLArrayIteratorEqual {
+        constructor(iter, key) 
+        {
+                this.iter = iter;
+                this.key = key;
+        }
+
+        next() 
+        {
+                const result = this.iter.next();
+                const keys = this.iter.tree.keys;
+                if(!result.done && this.key < keys[result.value]) {
+                        result.value = 0;
+                        result.done = true;
+                }
+                return result;
+        }
+
+        [Symbol.iterator]() 
+        {
+                return this;
+        }
+};
+
+/** AVLArrayTree whose nodes live in a SharedArrayBuffer for other threads */
+class AVLSharedTree extends AVLArrayTree {
+
+        /** Create a fixed size tree with room for options.capacity nodes. */
+        constructor(options) 
+        {
+                super({ capacity: 1 });
+                const capacity = options !== undefined && options.capacity > 0 ?
+                        options.capacity : 1024;
+                this.buffer = new SharedArrayBuffer(
+                        AVLSharedTree.bytes(capacity));
+                const views = AVLSharedTree.views(this.buffer, capacity);
+                this.header = views.header;
+                this.keys = views.keys;
+                this.values = views.values;
+                this.left = views.left;
+                this.right = views.right;
+                this.height = views.height;
+                Atomics.store(this.header, AVLSharedTree.CAPACITY, capacity);
+        }
+
+        /** Get the size in bytes of a buffer holding capacity nodes. */
+        static bytes(capacity) 
+        {
+                return 8 * AVLSharedTree.HEADER + 
+                        (capacity + 1) * (8 + 8 + 4 + 4 + 4);
+        }
+
+        /** Map the typed arrays onto a shared buffer. */
+        static views(buffer, capacity) 
+        {
+                const n = capacity + 1;
+                let offset = 8 * AVLSharedTree.HEADER;
+                const view = (Type) => {
+                        const array = new Type(buffer, offset, n);
+                        offset += n * Type.BYTES_PER_ELEMENT;
+                        return array;
+                };
+                return {
+                        header: new Int32Array(buffer, 0, 2 * AVLSharedTree.HEADER),
+                        keys: view(Float64Array),
+                        values: view(Float64Array),
+                        left: view(Int32Array),
+                        right: view(Int32Array),
+                        height: view(Int32Array),
+                };
+        }
+
+        /** Shared buffers cannot grow. */
+        grow() 
+        {
+                throw new RangeError("AVLSharedTree is full");
+        }
+
+        /** Start a write, making the version odd so readers retry. */
+        begin() 
+        {
+                Atomics.add(this.header, AVLSharedTree.VERSION, 1);
+        }
+
+        /** Publish the root and size, then make the version even again. */
+        publish() 
+        {
+                Atomics.store(this.header, AVLSharedTree.ROOT, this.root);
+                Atomics.store(this.header, AVLSharedTree.SIZE, this.size);
+                Atomics.add(this.header, AVLSharedTree.VERSION, 1);
+        }
+
+        /** Add a new entry unless it already exists or the buffer is full. */
+        add(key, value) 
+        {
+                if(this.free === 0 && this.next === this.keys.length) {
+                        return 0;
+                }
+                this.begin();
+                const node = super.add(key, value);
+                this.publish();
+                return node;
+        }
+
+        /** Remove the entry with the given key. */
+        remove(key, result) 
+        {
+                this.begin();
+                const tree = super.remove(key, result);
+                this.publish();
+                return tree;
+        }
+
+        /** Remove the first entry. */
+        removeMin(result) 
+        {
+                this.begin();
+                const tree = super.removeMin(result);
+                this.publish();
+                return tree;
+        }
+
+        /** Remove the last entry. */
+        removeMax(result) 
+        {
+                this.begin();
+                const tree = super.removeMax(result);
+                this.publish();
+                return tree;
+        }
+
+        /** Replace the node's value. */
+        setValue(node, value) 
+        {
+                this.begin();
+                super.setValue(node, value);
+                this.publish();
+                return this;
+        }
+}
+
+AVLSharedTree.VERSION = 0;
+AVLSharedTree.ROOT = 1;
+AVLSharedTree.SIZE = 2;
+AVLSharedTree.CAPACITY = 3;
+AVLSharedTree.HEADER = 2; /* 8 byte words before the node arrays */
+
+/** Lock-free reader of an AVLSharedTree's buffer (seqlock retry on writes) */
+class AVLSharedReader {
+
+        /** Attach to the buffer of an AVLSharedTree, e.g. from workerData. */
+        constructor(buffer) 
+        {
+                const header = new Int32Array(buffer, 0, 2 * AVLSharedTree.HEADER);
+                this.capacity = Atomics.load(header, AVLSharedTree.CAPACITY);
+                Object.assign(this, AVLSharedTree.views(buffer, this.capacity));
+                this.stack = new Int32Array(64);
+                this.retries = 0;
+        }
+
+        /** Wait for an even version, i.e. no write in progress. */
+        enter() 
+        {
+                for(;;) {
+                        const version = Atomics.load(
+                                this.header, AVLSharedTree.VERSION);
+                        if((version & 1) === 0) {
+                                return version;
+                        }
+                        this.retries += 1;
+                }
+        }
+
+        /** Check that no write happened since enter returned version. */
+        valid(version) 
+        {
+                if(Atomics.load(this.header, AVLSharedTree.VERSION) === version) {
+                        return true;
+                }
+                this.retries += 1;
+                return false;
+        }
+
+        /** Get the number of entries. */
+        get size() 
+        {
+                return Atomics.load(this.header, AVLSharedTree.SIZE);
+        }
+
+        /** Get the key's value, or missing if it does not exist. */
+        get(key, missing) 
+        {
+                for(;;) {
+                        const version = this.enter();
+                        let node = Atomics.load(this.header, AVLSharedTree.ROOT);
+                        let value = missing;
+                        for(let depth = 0; node > 0 && node <= this.capacity && 
+                                depth < this.stack.length; ++depth) 
+                        {
+                                const k = this.keys[node];
+                                if(key < k) {
+                                        node = this.left[node];
+                                } else if(k < key) {
+                                        node = this.right[node];
+                                } else {
+                                        value = this.values[node];
+                                        break;
+                                }
+                        }
+                        if(this.valid(version)) {
+                                return value;
+                        }
+                }
+        }
+
+        /** Copy the entries in [lo, hi] into the arrays, returning the count. */
+        range(lo, hi, keys, values) 
+        {
+                for(;;) {
+                        const version = this.enter();
+                        const count = this.scan(lo, hi, keys, values);
+                        if(count >= 0 && this.valid(version)) {
+                                return count;
+                        }
+                }
+        }
+
+        /** Helper function for AVLSharedReader.range, -1 if the read tore. */
+        scan(lo, hi, keys, values) 
+        {
+                const stack = this.stack;
+                const limit = keys.length < values.length ? 
+                        keys.length : values.length;
+                let node = Atomics.load(this.header, AVLSharedTree.ROOT);
+                let depth = 0;
+                let count = 0;
+                for(let steps = 0; steps <= 2 * this.capacity + 2; ++steps) {
+                        if(node < 0 || node > this.capacity) {
+                                return -1;
+                        } else if(node !== 0) {
+                                if(depth === stack.length) {
+                                        return -1;
+                                } else if(this.keys[node] < lo) {
+                                        node = this.right[node];
+                                } else {
+                                        stack[depth++] = node;
+                                        node = this.left[node];
+                                }
+                        } else if(depth === 0) {
+                                return count;
+                        } else {
+                                node = stack[--depth];
+                                const k = this.keys[node];
+                                if(hi < k || count === limit) {
+                                        return count;
+                                }
+                                keys[count] = k;
+                                values[count] = this.values[node];
+                                count += 1;
+                                node = this.right[node];
+                        }
+                }
+                return -1;
+        }
+}
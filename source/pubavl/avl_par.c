@@ -0,0 +1,240 @@
+
+#include "pubavl/avl_par.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+/** A whole subtree, or a single ancestor above the cut depth. */
+struct avl_par_piece {
+        struct avl_node *node;
+        int whole;
+        size_t count;
+        size_t offset;
+};
+
+/** Shared state of one parallel scan. */
+struct avl_par {
+        struct avl_par_piece pieces[AVL_PAR_PIECES];
+        size_t count;
+        size_t next;
+        pthread_mutex_t lock;
+        int counting;
+        avl_par_rank_t rank;
+        avl_par_visit_t visit;
+        void *state;
+};
+
+/** One worker's share of a scan. */
+struct avl_par_worker {
+        struct avl_par *par;
+        void *local;
+        pthread_t thread;
+};
+
+/** Destination arrays of avl_par_export. */
+struct avl_par_arrays {
+        struct avl_kv *keys;
+        struct avl_kv *values;
+};
+
+void avl_par_cut(struct avl_par *par, struct avl_node *node, size_t depth)
+{
+        if(!node) {
+                return;
+        } else if(depth == AVL_PAR_DEPTH) {
+                assert(par->count < AVL_PAR_PIECES);
+                par->pieces[par->count].node = node;
+                par->pieces[par->count++].whole = 1;
+                return;
+        }
+        (void)avl_par_cut(par, node->left, depth + 1);
+        assert(par->count < AVL_PAR_PIECES);
+        par->pieces[par->count].node = node;
+        par->pieces[par->count++].whole = 0;
+        (void)avl_par_cut(par, node->right, depth + 1);
+}
+
+struct avl_stack *avl_par_stack(
+        struct avl_node *node,
+        struct avl_stack *stack)
+{
+        (void)avl_stack_reset(stack);
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(!node) {
+                        return stack;
+                }
+                stack->array[stack->size++] = node;
+                node = node->left;
+        }
+        assert(0);
+        return NULL;
+}
+
+struct avl_par_piece *avl_par_claim(struct avl_par *par)
+{
+        struct avl_par_piece *piece = NULL;
+        (void)pthread_mutex_lock(&par->lock);
+        if(par->next < par->count) {
+                piece = &par->pieces[par->next++];
+        }
+        (void)pthread_mutex_unlock(&par->lock);
+        return piece;
+}
+
+size_t avl_par_each(
+        struct avl_par_worker *worker,
+        struct avl_par_piece *piece,
+        struct avl_node *node,
+        size_t n)
+{
+        struct avl_par *par = worker->par;
+        if(par->rank && !par->counting) {
+                par->rank(par->state, node, piece->offset + n);
+        } else if(!par->rank) {
+                par->visit(worker->local, node);
+        }
+        return n + 1;
+}
+
+void *avl_par_work(void *arg)
+{
+        struct avl_par_worker *worker = arg;
+        struct avl_par_piece *piece;
+        struct avl_stack stack;
+        struct avl_node *node;
+        (void)avl_stack_init(&stack);
+        while((piece = avl_par_claim(worker->par))) {
+                size_t n = 0;
+                if(!piece->whole) {
+                        if(!(piece->node->height & AVL_DEAD)) {
+                                n = avl_par_each(worker, piece, piece->node, n);
+                        }
+                } else if(avl_par_stack(piece->node, &stack)) {
+                        while(avl_next(&stack, &node)) {
+                                n = avl_par_each(worker, piece, node, n);
+                        }
+                }
+                piece->count = n;
+        }
+        return NULL;
+}
+
+void avl_par_run(
+        struct avl_par *par,
+        struct avl_par_worker *workers,
+        size_t threads)
+{
+        size_t started = 1;
+        par->next = 0;
+        for(; started < threads; ++started) {
+                if(pthread_create(&workers[started].thread, NULL,
+                        avl_par_work, &workers[started]))
+                {
+                        break;
+                }
+        }
+        (void)avl_par_work(&workers[0]);
+        for(size_t n = 1; n < started; ++n) {
+                (void)pthread_join(workers[n].thread, NULL);
+        }
+}
+
+struct avl_tree *avl_par_scan(
+        struct avl_tree *tree,
+        size_t threads,
+        struct avl_par *par,
+        void *locals,
+        size_t local_size)
+{
+        struct avl_par_worker workers[AVL_PAR_THREADS];
+        size_t offset = 0;
+        if(!threads) {
+                return NULL;
+        } else if(threads > AVL_PAR_THREADS) {
+                threads = AVL_PAR_THREADS;
+        }
+        if(pthread_mutex_init(&par->lock, NULL)) {
+                return NULL;
+        }
+        par->count = 0;
+        (void)avl_par_cut(par, tree->root, 0);
+        for(size_t n = 0; n < threads; ++n) {
+                workers[n].par = par;
+                workers[n].local = locals ?
+                        (char *)locals + n * local_size : NULL;
+        }
+        if(par->rank) {
+                par->counting = 1;
+                (void)avl_par_run(par, workers, threads);
+                for(size_t n = 0; n < par->count; ++n) {
+                        par->pieces[n].offset = offset;
+                        offset += par->pieces[n].count;
+                }
+                assert(offset == tree->size);
+        }
+        par->counting = 0;
+        (void)avl_par_run(par, workers, threads);
+        (void)pthread_mutex_destroy(&par->lock);
+        return tree;
+}
+
+struct avl_tree *avl_par_ranked(
+        struct avl_tree *tree,
+        size_t threads,
+        avl_par_rank_t visit,
+        void *state)
+{
+        struct avl_par par;
+        par.rank = visit;
+        par.visit = NULL;
+        par.state = state;
+        return avl_par_scan(tree, threads, &par, NULL, 0);
+}
+
+void avl_par_copy(void *state, struct avl_node *node, size_t rank)
+{
+        struct avl_par_arrays *arrays = state;
+        if(arrays->keys) {
+                arrays->keys[rank] = node->key;
+        }
+        if(arrays->values) {
+                arrays->values[rank] = node->value;
+        }
+}
+
+struct avl_tree *avl_par_export(
+        struct avl_tree *tree,
+        size_t threads,
+        struct avl_kv *keys,
+        struct avl_kv *values)
+{
+        struct avl_par_arrays arrays;
+        arrays.keys = keys;
+        arrays.values = values;
+        return avl_par_ranked(tree, threads, avl_par_copy, &arrays);
+}
+
+struct avl_tree *avl_par_reduce(
+        struct avl_tree *tree,
+        size_t threads,
+        avl_par_visit_t visit,
+        void *locals,
+        size_t local_size,
+        avl_par_merge_t merge,
+        void *state)
+{
+        struct avl_par par;
+        par.rank = NULL;
+        par.visit = visit;
+        par.state = state;
+        if(threads > AVL_PAR_THREADS) {
+                threads = AVL_PAR_THREADS;
+        }
+        if(!avl_par_scan(tree, threads, &par, locals, local_size)) {
+                return NULL;
+        }
+        for(size_t n = 0; n < threads; ++n) {
+                merge(state, (char *)locals + n * local_size);
+        }
+        return tree;
+}
@@ -0,0 +1,334 @@
+
+#include "pubavl/avl.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef AVL_FULL_RETRACE
+#define BENCH_RETRACE "full"
+#else
+#define BENCH_RETRACE "early"
+#endif
+
+int cmp_i64(struct avl_kv a, struct avl_kv b)
+{
+        return a.u.i64 < b.u.i64;
+}
+
+struct avl_node *alloc_node(void *heap)
+{
+        return malloc(sizeof(struct avl_node));
+}
+
+void free_node(void *heap, struct avl_node *node)
+{
+        (void)free(node);
+}
+
+uint64_t bench_rand(uint64_t *state)
+{
+        uint64_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        return *state = x;
+}
+
+double bench_seconds(clock_t start)
+{
+        return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void bench_print(
+        const char *name,
+        const size_t ops,
+        const double seconds,
+        struct avl_tree *tree)
+{
+        (void)printf("%-24s %-6s %9zu ops %8.1f ns/op",
+                name, BENCH_RETRACE, ops, 1e9 * seconds / (double)ops);
+#ifdef AVL_STATS
+        (void)printf(" %6.2f writes/op %6.3f rotations/op",
+                (double)tree->stats.retraces / (double)ops,
+                (double)(tree->stats.rotations + tree->stats.double_rotations)
+                        / (double)ops);
+#endif
+        (void)putchar('\n');
+}
+
+void bench_churn(const char *name, const unsigned int mode, const size_t count)
+{
+        struct avl_tree tree;
+        struct avl_stack stack;
+        uint64_t seed = 88172645463325252ULL;
+        int64_t *keys = malloc(count * sizeof(int64_t));
+        clock_t start;
+        if(!keys) {
+                return;
+        }
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(&tree, mode);
+        (void)avl_stack_init(&stack);
+        for(size_t i = 0; i < count; ++i) {
+                keys[i] = (int64_t)(bench_rand(&seed) >> 1);
+        }
+        start = clock();
+        for(size_t i = 0; i < count; ++i) {
+                (void)avl_add(&tree, &stack,
+                        AVL_KV(i64, keys[i]), AVL_KV(i64, 0));
+        }
+        bench_print("add", count, bench_seconds(start), &tree);
+#ifdef AVL_STATS
+        (void)avl_stats_reset(&tree);
+#endif
+        start = clock();
+        for(size_t i = 0; i < count; ++i) {
+                const size_t victim = (size_t)(bench_rand(&seed) % count);
+                (void)avl_remove(&tree, &stack,
+                        AVL_KV(i64, keys[victim]), NULL, NULL);
+                keys[victim] = (int64_t)(bench_rand(&seed) >> 1);
+                (void)avl_add(&tree, &stack,
+                        AVL_KV(i64, keys[victim]), AVL_KV(i64, 0));
+        }
+        bench_print(name, 2 * count, bench_seconds(start), &tree);
+#ifdef AVL_STATS
+        (void)avl_stats_reset(&tree);
+#endif
+        start = clock();
+        for(size_t i = 0; i < count; ++i) {
+                (void)avl_remove(&tree, &stack,
+                        AVL_KV(i64, keys[i]), NULL, NULL);
+        }
+        bench_print("remove", count, bench_seconds(start), &tree);
+        (void)avl_free_nodes(&tree, &stack);
+        (void)free(keys);
+}
+
+void bench_get(
+        const char *name,
+        avl_hash_t index,
+        avl_hash_t filter,
+        const size_t count)
+{
+        struct avl_tree tree;
+        struct avl_stack stack;
+        uint64_t seed = 88172645463325252ULL;
+        clock_t start;
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        if(index && !avl_tree_index(&tree, &stack, index)) {
+                return;
+        } else if(filter && !avl_tree_filter(&tree, &stack, filter)) {
+                return;
+        }
+        for(size_t i = 0; i < count; ++i) {
+                (void)avl_add(&tree, &stack,
+                        AVL_KV(i64, (int64_t)(2 * i)), AVL_KV(i64, 0));
+        }
+#ifdef AVL_STATS
+        (void)avl_stats_reset(&tree);
+#endif
+        start = clock();
+        for(size_t i = 0; i < count; ++i) {
+                const int64_t k = (int64_t)(bench_rand(&seed) % (2 * count));
+                (void)avl_get(&tree, AVL_KV(i64, k));
+        }
+        bench_print(name, count, bench_seconds(start), &tree);
+        (void)avl_tree_free(&tree, &stack);
+}
+
+void bench_hot(const char *name, const size_t slots, const size_t count)
+{
+        struct avl_tree tree;
+        struct avl_stack stack;
+        uint64_t seed = 88172645463325252ULL;
+        clock_t start;
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        if(slots && !avl_tree_cache(&tree, avl_hash_u64, slots)) {
+                return;
+        }
+        for(size_t i = 0; i < count; ++i) {
+                (void)avl_add(&tree, &stack,
+                        AVL_KV(i64, (int64_t)i), AVL_KV(i64, 0));
+        }
+#ifdef AVL_STATS
+        (void)avl_stats_reset(&tree);
+#endif
+        start = clock();
+        for(size_t i = 0; i < count; ++i) {
+                const uint64_t r = bench_rand(&seed);
+                const uint64_t k = r & 1 ? (r >> 1) % 64 * 997 : (r >> 1) % count;
+                (void)avl_get(&tree, AVL_KV(i64, (int64_t)(k % count)));
+        }
+        bench_print(name, count, bench_seconds(start), &tree);
+        (void)avl_tree_free(&tree, &stack);
+}
+
+void bench_expire(const char *name, const int truncate, const size_t count)
+{
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_kv key;
+        const size_t window = 1024;
+        clock_t start;
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        for(size_t i = 0; i < count; ++i) {
+                (void)avl_add(&tree, &stack,
+                        AVL_KV(i64, (int64_t)i), AVL_KV(i64, 0));
+        }
+#ifdef AVL_STATS
+        (void)avl_stats_reset(&tree);
+#endif
+        start = clock();
+        for(size_t i = window; i <= count; i += window) {
+                const struct avl_kv cutoff = AVL_KV(i64, (int64_t)i);
+                if(truncate) {
+                        (void)avl_truncate_below(
+                                &tree, &stack, cutoff, NULL, NULL);
+                        continue;
+                }
+                while(tree.min && tree.min->key.u.i64 < cutoff.u.i64) {
+                        (void)avl_remove_min(&tree, &stack, &key, NULL);
+                }
+        }
+        bench_print(name, count, bench_seconds(start), &tree);
+        (void)avl_free_nodes(&tree, &stack);
+}
+
+struct bench_value {
+        int64_t fields[4];
+};
+
+struct avl_node *alloc_inline(void *heap)
+{
+        return malloc(((struct avl_tree *)heap)->node_size);
+}
+
+void bench_value(const char *name, const int inline_value, const size_t count)
+{
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        struct bench_value value = { { 0 } }, *slot;
+        uint64_t seed = 88172645463325252ULL;
+        int64_t sum = 0;
+        clock_t start;
+        (void)avl_tree_init(&tree, cmp_i64, alloc_inline, free_node, &tree);
+        (void)avl_stack_init(&stack);
+        if(inline_value) {
+                (void)avl_tree_inline(&tree, sizeof(struct bench_value));
+        }
+        for(size_t i = 0; i < count; ++i) {
+                const struct avl_kv key = AVL_KV(i64, (int64_t)i);
+                value.fields[3] = (int64_t)i;
+                if(inline_value) {
+                        (void)avl_add_inline(&tree, &stack, key, &value);
+                } else if((slot = malloc(sizeof(struct bench_value)))) {
+                        *slot = value;
+                        (void)avl_add(&tree, &stack, key, AVL_KV(ptr, slot));
+                }
+        }
+#ifdef AVL_STATS
+        (void)avl_stats_reset(&tree);
+#endif
+        start = clock();
+        for(size_t i = 0; i < count; ++i) {
+                const int64_t k = (int64_t)(bench_rand(&seed) % count);
+                if((node = avl_get(&tree, AVL_KV(i64, k)))) {
+                        slot = inline_value ?
+                                avl_value(&tree, node) : node->value.u.ptr;
+                        sum += slot->fields[3];
+                }
+        }
+        bench_print(name, count, bench_seconds(start), &tree);
+        if(!inline_value && avl_traverse(&tree, &stack)) {
+                while(avl_next(&stack, &node)) {
+                        (void)free(node->value.u.ptr);
+                }
+        }
+        (void)avl_free_nodes(&tree, &stack);
+        if(!sum) {
+                (void)puts("no values read");
+        }
+}
+
+#ifdef AVL_COUNTS
+int64_t bench_skewed(uint64_t *seed, const size_t count)
+{
+        const double u = (double)(bench_rand(seed) >> 11) / 9007199254740992.0;
+        const uint64_t rank = (uint64_t)((double)count * u * u * u * u);
+        return (int64_t)(rank * 2654435761ULL % count);
+}
+
+double bench_depth(struct avl_tree *tree, const size_t count)
+{
+        uint64_t seed = 88172645463325252ULL;
+        size_t total = 0;
+        for(size_t i = 0; i < count; ++i) {
+                const int64_t k = bench_skewed(&seed, count);
+                struct avl_node *node = tree->root;
+                while(node && node->key.u.i64 != k) {
+                        node = k < node->key.u.i64 ? node->left : node->right;
+                        total += 1;
+                }
+        }
+        return 1.0 + (double)total / (double)count;
+}
+
+void bench_skew(const char *name, const int reshape, const size_t count)
+{
+        struct avl_tree tree;
+        struct avl_stack stack;
+        uint64_t seed = 11400714819323198485ULL;
+        clock_t start;
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(&tree, AVL_TRACK_HITS);
+        (void)avl_stack_init(&stack);
+        for(size_t i = 0; i < count; ++i) {
+                (void)avl_add(&tree, &stack,
+                        AVL_KV(i64, (int64_t)i), AVL_KV(i64, 0));
+        }
+        for(size_t i = 0; reshape && i < count; ++i) {
+                (void)avl_get(&tree, AVL_KV(i64, bench_skewed(&seed, count)));
+        }
+        if(reshape && !avl_reshape(&tree, &stack)) {
+                (void)avl_free_nodes(&tree, &stack);
+                return;
+        }
+#ifdef AVL_STATS
+        (void)avl_stats_reset(&tree);
+#endif
+        seed = 88172645463325252ULL;
+        start = clock();
+        for(size_t i = 0; i < count; ++i) {
+                (void)avl_get(&tree, AVL_KV(i64, bench_skewed(&seed, count)));
+        }
+        bench_print(name, count, bench_seconds(start), &tree);
+        (void)printf("%-24s %6.2f average depth\n",
+                name, bench_depth(&tree, count));
+        (void)avl_free_nodes(&tree, &stack);
+}
+#endif
+
+int main(int argc, char **args)
+{
+        const size_t count = argc > 1 ? (size_t)atol(args[1]) : 1000000;
+        bench_churn("churn", 0, count);
+        bench_churn("wavl churn", AVL_WAVL, count);
+        bench_get("get", NULL, NULL, count);
+        bench_get("indexed get", avl_hash_u64, NULL, count);
+        bench_get("filtered get", NULL, avl_hash_u64, count);
+        bench_hot("hot get", 0, count);
+        bench_hot("cached hot get", 1024, count);
+        bench_expire("expire min", 0, count);
+        bench_expire("expire truncate", 1, count);
+        bench_value("boxed value get", 0, count);
+        bench_value("inline value get", 1, count);
+#ifdef AVL_COUNTS
+        bench_skew("skewed get", 0, count);
+        bench_skew("reshaped skewed get", 1, count);
+#endif
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,229 @@
+
+/* Run with: node --expose-gc -e "$(cat avl.js bench_avl.js); benchSuite()" */
+
+const { performance, PerformanceObserver } = require("perf_hooks");
+
+/** Unbiased Fisher-Yates shuffle. */
+function benchShuffle(array) 
+{
+        for(let n = array.length - 1; n > 0; --n) {
+                const r = Math.floor(Math.random() * (n + 1));
+                const t = array[n];
+                array[n] = array[r];
+                array[r] = t;
+        }
+        return array;
+}
+
+/** Key distributions: the order keys are inserted and looked up in. */
+const benchKeys = {
+        random: (count) => benchShuffle(Array.from({ length: count }, (_, n) => n)),
+        sorted: (count) => Array.from({ length: count }, (_, n) => n),
+        clustered: (count) => {
+                const keys = [];
+                const runs = benchShuffle(Array.from(
+                        { length: Math.ceil(count / 64) }, (_, n) => n));
+                for(const run of runs) {
+                        for(let n = 64 * run; n < 64 * run + 64 && n < count; ++n) {
+                                keys.push(n);
+                        }
+                }
+                return keys;
+        },
+};
+
+/** Sorted array index, the ordered baseline. */
+class BenchSortedArray {
+        constructor() 
+        {
+                this.keys = [];
+                this.values = [];
+        }
+
+        search(key) 
+        {
+                let lo = 0, hi = this.keys.length;
+                while(lo < hi) {
+                        const mid = (lo + hi) >>> 1;
+                        if(this.keys[mid] < key) {
+                                lo = mid + 1;
+                        } else {
+                                hi = mid;
+                        }
+                }
+                return lo;
+        }
+
+        add(key, value) 
+        {
+                const n = this.search(key);
+                if(this.keys[n] === key) {
+                        return false;
+                }
+                this.keys.splice(n, 0, key);
+                this.values.splice(n, 0, value);
+                return true;
+        }
+
+        get(key) 
+        {
+                const n = this.search(key);
+                return this.keys[n] === key ? this.values[n] : undefined;
+        }
+
+        remove(key) 
+        {
+                const n = this.search(key);
+                if(this.keys[n] !== key) {
+                        return false;
+                }
+                this.keys.splice(n, 1);
+                this.values.splice(n, 1);
+                return true;
+        }
+}
+
+/** The structures under test, behind a common interface. */
+const benchSubjects = [
+        {
+                name: "AVLTree",
+                create: () => new AVLTree(),
+                add: (t, k) => t.add(k, k),
+                get: (t, k) => t.get(k),
+                remove: (t, k) => t.remove(k),
+                iterate: (t) => { let n = 0; for(const node of t) n += 1; return n; },
+        },
+        {
+                name: "AVLArrayTree",
+                create: () => new AVLArrayTree(),
+                add: (t, k) => t.add(k, k),
+                get: (t, k) => t.get(k),
+                remove: (t, k) => t.remove(k),
+                iterate: (t) => { let n = 0; for(const node of t) n += 1; return n; },
+        },
+        {
+                name: "Map",
+                create: () => new Map(),
+                add: (t, k) => t.set(k, k),
+                get: (t, k) => t.get(k),
+                remove: (t, k) => t.delete(k),
+                iterate: (t) => { let n = 0; for(const e of t) n += 1; return n; },
+        },
+        {
+                name: "SortedArray",
+                limit: 100000,
+                create: () => new BenchSortedArray(),
+                add: (t, k) => t.add(k, k),
+                get: (t, k) => t.get(k),
+                remove: (t, k) => t.remove(k),
+                iterate: (t) => { let n = 0; for(const k of t.keys) n += 1; return n; },
+        },
+];
+
+/** Accumulate the duration of garbage collections. */
+const benchGC = { ms: 0, count: 0 };
+
+/** Let queued performance entries reach their observers. */
+function benchFlush() 
+{
+        return new Promise((resolve) => setTimeout(resolve, 10));
+}
+
+/** Get the bytes held by the JS heap and typed array buffers. */
+async function benchHeap() 
+{
+        if(typeof global.gc === "function") {
+                global.gc();
+        }
+        await benchFlush();
+        const usage = process.memoryUsage();
+        return usage.heapUsed + usage.arrayBuffers;
+}
+
+/** Get the p-th percentile of the sorted samples in nanoseconds. */
+function benchPercentile(samples, count, p) 
+{
+        return count < 100 ? "-" : 
+                (1e6 * samples[Math.floor(p * count)]).toFixed(0);
+}
+
+/** Time op over every key, sampling the latency of one op in every 8. */
+async function benchPhase(phase, keys, op, ops) 
+{
+        const samples = new Float64Array(Math.ceil(keys.length / 8));
+        let nsamples = 0;
+        await benchFlush();
+        const gcMs = benchGC.ms;
+        const start = performance.now();
+        for(let n = 0; n < keys.length; ++n) {
+                if((n & 7) === 0) {
+                        const t = performance.now();
+                        op(keys[n]);
+                        samples[nsamples++] = performance.now() - t;
+                } else {
+                        op(keys[n]);
+                }
+        }
+        const ms = performance.now() - start;
+        await benchFlush();
+        samples.subarray(0, nsamples).sort();
+        return [
+                phase.padEnd(8),
+                ((ops || keys.length) / ms * 1e3).toExponential(2).padStart(9),
+                benchPercentile(samples, nsamples, 0.5).padStart(7),
+                benchPercentile(samples, nsamples, 0.99).padStart(7),
+                benchPercentile(samples, nsamples, 0.999).padStart(8),
+                (benchGC.ms - gcMs).toFixed(1).padStart(8),
+        ];
+}
+
+async function benchRun(subject, dist, count) 
+{
+        const keys = benchKeys[dist](count);
+        const lookups = benchShuffle(keys.slice());
+        const rows = [];
+        const before = await benchHeap();
+        const t = subject.create();
+        rows.push(await benchPhase("add", keys, (k) => subject.add(t, k)));
+        const heap = ((await benchHeap() - before) / (1 << 20)).toFixed(1);
+        rows.push(await benchPhase("get", lookups, (k) => subject.get(t, k)));
+        rows.push(await benchPhase("iterate", [0], () => {
+                if(subject.iterate(t) !== count) throw new Error();
+        }, count));
+        rows.push(await benchPhase("remove", lookups, (k) => subject.remove(t, k)));
+        for(const row of rows) {
+                console.log([ 
+                        subject.name.padEnd(13), dist.padEnd(10), 
+                        String(count).padStart(8), ...row, heap.padStart(8),
+                ].join(" "));
+        }
+}
+
+/** Benchmark every subject and key distribution at each tree size. */
+async function benchSuite(sizes) 
+{
+        sizes = sizes || [1000, 10000, 100000, 1000000];
+        const observer = new PerformanceObserver((list) => {
+                for(const entry of list.getEntries()) {
+                        benchGC.ms += entry.duration;
+                        benchGC.count += 1;
+                }
+        });
+        observer.observe({ entryTypes: ["gc"] });
+        if(typeof global.gc !== "function") {
+                console.log("heap deltas include garbage; run with --expose-gc");
+        }
+        console.log("subject       dist          size phase      ops/s" +
+                "  p50 ns  p99 ns p99.9 ns    gc ms   mem MB");
+        for(const count of sizes) {
+                for(const dist of Object.keys(benchKeys)) {
+                        for(const subject of benchSubjects) {
+                                if(!subject.limit || count <= subject.limit) {
+                                        await benchRun(subject, dist, count);
+                                }
+                        }
+                }
+        }
+        observer.disconnect();
+        console.log(`total gc ${benchGC.ms.toFixed(1)} ms in ${benchGC.count} collections`);
+}
@@ -0,0 +1,691 @@
+#include "pubavl/bpt.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#if (defined(__AVX2__) || defined(__SSE4_2__)) && AVL_KV_HINT >= 64
+#include <immintrin.h>
+#endif
+
+#define BPT_MIN (BPT_ORDER / 2)
+
+/** Branches from the root down to a leaf. */
+struct bpt_path {
+        struct bpt_node *nodes[AVL_STACK_MAX];
+        size_t index[AVL_STACK_MAX];
+        size_t size;
+};
+
+int bpt_cmp_i64(struct avl_kv a, struct avl_kv b)
+{
+        return a.u.i64 < b.u.i64;
+}
+
+size_t bpt_rank_i64(
+        const struct avl_kv *keys,
+        const size_t count,
+        const int64_t key,
+        const int upper)
+{
+        size_t rank = 0, i = 0;
+#if defined(__AVX2__) && AVL_KV_HINT >= 64
+        const __m256i probe = _mm256_set1_epi64x(key);
+        for(; i + 4 <= count; i += 4) {
+                const __m256i k = _mm256_loadu_si256((const __m256i*)(keys + i));
+                const __m256i m = upper ?
+                        _mm256_cmpgt_epi64(k, probe) :
+                        _mm256_cmpgt_epi64(probe, k);
+                rank += (size_t)__builtin_popcount(
+                        (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+        }
+#elif defined(__SSE4_2__) && AVL_KV_HINT >= 64
+        const __m128i probe = _mm_set1_epi64x(key);
+        for(; i + 2 <= count; i += 2) {
+                const __m128i k = _mm_loadu_si128((const __m128i*)(keys + i));
+                const __m128i m = upper ?
+                        _mm_cmpgt_epi64(k, probe) :
+                        _mm_cmpgt_epi64(probe, k);
+                rank += (size_t)__builtin_popcount(
+                        (unsigned)_mm_movemask_pd(_mm_castsi128_pd(m)));
+        }
+#endif
+        for(; i < count; ++i) {
+                rank += upper ? keys[i].u.i64 > key : keys[i].u.i64 < key;
+        }
+        return upper ? count - rank : rank;
+}
+
+size_t bpt_rank(
+        struct bpt_tree *tree,
+        struct bpt_node *node,
+        struct avl_kv key,
+        const int upper)
+{
+        size_t lo = 0, hi = node->count;
+        if(tree->i64) {
+                return bpt_rank_i64(node->keys, node->count, key.u.i64, upper);
+        }
+        while(lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                if(upper ?
+                        !tree->cmp(key, node->keys[mid]) :
+                        tree->cmp(node->keys[mid], key))
+                {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        return lo;
+}
+
+struct bpt_node *bpt_node_init(struct bpt_node *node, const int leaf)
+{
+        assert(node);
+        (void)memset(node, 0, sizeof(struct bpt_node));
+        node->leaf = leaf;
+        return node;
+}
+
+struct bpt_node *bpt_descend(
+        struct bpt_tree *tree,
+        struct bpt_path *path,
+        struct avl_kv key)
+{
+        struct bpt_node *node = tree->root;
+        path->size = 0;
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(node->leaf) {
+                        return node;
+                }
+                const size_t index = bpt_rank(tree, node, key, 1);
+                path->nodes[path->size] = node;
+                path->index[path->size++] = index;
+                node = node->u.children[index];
+        }
+        assert(0);
+        return NULL;
+}
+
+struct bpt_node *bpt_descend_edge(
+        struct bpt_tree *tree,
+        struct bpt_path *path,
+        const int last)
+{
+        struct bpt_node *node = tree->root;
+        path->size = 0;
+        for(size_t I = 0; I < AVL_STACK_MAX; ++I) {
+                if(node->leaf) {
+                        return node;
+                }
+                const size_t index = last ? node->count : 0;
+                path->nodes[path->size] = node;
+                path->index[path->size++] = index;
+                node = node->u.children[index];
+        }
+        assert(0);
+        return NULL;
+}
+
+struct bpt_tree *bpt_tree_init(
+        struct bpt_tree *tree,
+        avl_cmp_t cmp,
+        bpt_alloc_t alloc,
+        bpt_free_t free,
+        void *state)
+{
+        assert(tree);
+        tree->root = NULL;
+        tree->size = 0;
+        tree->cmp = cmp;
+        tree->alloc = alloc;
+        tree->free = free;
+        tree->heap = state;
+        tree->i64 = 0;
+        return tree;
+}
+
+struct bpt_tree *bpt_tree_init_i64(
+        struct bpt_tree *tree,
+        bpt_alloc_t alloc,
+        bpt_free_t free,
+        void *state)
+{
+        (void)bpt_tree_init(tree, bpt_cmp_i64, alloc, free, state);
+        tree->i64 = 1;
+        return tree;
+}
+
+void bpt_node_free(struct bpt_tree *tree, struct bpt_node *node)
+{
+        struct bpt_node *stack[AVL_STACK_MAX];
+        size_t index[AVL_STACK_MAX];
+        size_t size = 0;
+        if(!node) {
+                return;
+        }
+        stack[0] = node;
+        index[0] = 0;
+        size = 1;
+        while(size) {
+                struct bpt_node *top = stack[size - 1];
+                if(top->leaf || index[size - 1] > top->count) {
+                        size -= 1;
+                        tree->free(tree->heap, top);
+                } else {
+                        assert(size < AVL_STACK_MAX);
+                        stack[size] = top->u.children[index[size - 1]++];
+                        index[size++] = 0;
+                }
+        }
+}
+
+void bpt_free_nodes(struct bpt_tree *tree)
+{
+        bpt_node_free(tree, tree->root);
+        tree->root = NULL;
+        tree->size = 0;
+}
+
+struct bpt_node *bpt_insert_branch(
+        struct bpt_node *node,
+        const size_t index,
+        struct avl_kv key,
+        struct bpt_node *child)
+{
+        const size_t count = node->count;
+        (void)memmove(
+                node->keys + index + 1,
+                node->keys + index,
+                (count - index) * sizeof(struct avl_kv));
+        (void)memmove(
+                node->u.children + index + 2,
+                node->u.children + index + 1,
+                (count - index) * sizeof(struct bpt_node*));
+        node->keys[index] = key;
+        node->u.children[index + 1] = child;
+        node->count += 1;
+        return node;
+}
+
+struct avl_kv *bpt_add(
+        struct bpt_tree *tree,
+        struct avl_kv key,
+        struct avl_kv value)
+{
+        struct bpt_node *spare[AVL_STACK_MAX + 1];
+        struct bpt_path path;
+        struct bpt_node *leaf, *right, *node;
+        struct avl_kv *slot, sep;
+        size_t pos, nspare = 0, used = 0;
+        if(!tree->root) {
+                node = tree->alloc(tree->heap);
+                if(!node) {
+                        return NULL;
+                }
+                tree->root = bpt_node_init(node, 1);
+        }
+        leaf = bpt_descend(tree, &path, key);
+        pos = bpt_rank(tree, leaf, key, 0);
+        if(pos < leaf->count && !tree->cmp(key, leaf->keys[pos])) {
+                return NULL;
+        }
+        if(leaf->count == BPT_ORDER) {
+                nspare = 2;
+                for(size_t n = path.size; n > 0; --n) {
+                        if(path.nodes[n - 1]->count < BPT_ORDER) {
+                                nspare -= 1;
+                                break;
+                        }
+                        nspare += 1;
+                }
+                for(size_t n = 0; n < nspare; ++n) {
+                        spare[n] = tree->alloc(tree->heap);
+                        if(!spare[n]) {
+                                while(n > 0) {
+                                        tree->free(tree->heap, spare[--n]);
+                                }
+                                return NULL;
+                        }
+                }
+        }
+        (void)memmove(
+                leaf->keys + pos + 1,
+                leaf->keys + pos,
+                (leaf->count - pos) * sizeof(struct avl_kv));
+        (void)memmove(
+                leaf->u.leaf.values + pos + 1,
+                leaf->u.leaf.values + pos,
+                (leaf->count - pos) * sizeof(struct avl_kv));
+        leaf->keys[pos] = key;
+        leaf->u.leaf.values[pos] = value;
+        leaf->count += 1;
+        tree->size += 1;
+        slot = leaf->u.leaf.values + pos;
+        if(leaf->count <= BPT_ORDER) {
+                return slot;
+        }
+        right = bpt_node_init(spare[used++], 1);
+        const size_t half = leaf->count / 2;
+        right->count = leaf->count - half;
+        (void)memcpy(
+                right->keys,
+                leaf->keys + half,
+                right->count * sizeof(struct avl_kv));
+        (void)memcpy(
+                right->u.leaf.values,
+                leaf->u.leaf.values + half,
+                right->count * sizeof(struct avl_kv));
+        leaf->count = half;
+        right->u.leaf.next = leaf->u.leaf.next;
+        right->u.leaf.prev = leaf;
+        if(leaf->u.leaf.next) {
+                leaf->u.leaf.next->u.leaf.prev = right;
+        }
+        leaf->u.leaf.next = right;
+        if(pos >= half) {
+                slot = right->u.leaf.values + (pos - half);
+        }
+        sep = right->keys[0];
+        node = leaf;
+        for(size_t n = path.size; n > 0; --n) {
+                struct bpt_node *parent = path.nodes[n - 1];
+                (void)bpt_insert_branch(parent, path.index[n - 1], sep, right);
+                if(parent->count <= BPT_ORDER) {
+                        assert(used == nspare);
+                        return slot;
+                }
+                const size_t mid = parent->count / 2;
+                right = bpt_node_init(spare[used++], 0);
+                sep = parent->keys[mid];
+                right->count = parent->count - mid - 1;
+                (void)memcpy(
+                        right->keys,
+                        parent->keys + mid + 1,
+                        right->count * sizeof(struct avl_kv));
+                (void)memcpy(
+                        right->u.children,
+                        parent->u.children + mid + 1,
+                        (right->count + 1) * sizeof(struct bpt_node*));
+                parent->count = mid;
+                node = parent;
+        }
+        assert(node == tree->root && used + 1 == nspare);
+        tree->root = bpt_node_init(spare[used++], 0);
+        tree->root->count = 1;
+        tree->root->keys[0] = sep;
+        tree->root->u.children[0] = node;
+        tree->root->u.children[1] = right;
+        return slot;
+}
+
+void bpt_merge(
+        struct bpt_tree *tree,
+        struct bpt_node *parent,
+        const size_t index)
+{
+        struct bpt_node *left = parent->u.children[index];
+        struct bpt_node *right = parent->u.children[index + 1];
+        if(left->leaf) {
+                (void)memcpy(
+                        left->keys + left->count,
+                        right->keys,
+                        right->count * sizeof(struct avl_kv));
+                (void)memcpy(
+                        left->u.leaf.values + left->count,
+                        right->u.leaf.values,
+                        right->count * sizeof(struct avl_kv));
+                left->count += right->count;
+                left->u.leaf.next = right->u.leaf.next;
+                if(right->u.leaf.next) {
+                        right->u.leaf.next->u.leaf.prev = left;
+                }
+        } else {
+                left->keys[left->count] = parent->keys[index];
+                (void)memcpy(
+                        left->keys + left->count + 1,
+                        right->keys,
+                        right->count * sizeof(struct avl_kv));
+                (void)memcpy(
+                        left->u.children + left->count + 1,
+                        right->u.children,
+                        (right->count + 1) * sizeof(struct bpt_node*));
+                left->count += right->count + 1;
+        }
+        assert(left->count <= BPT_ORDER);
+        (void)memmove(
+                parent->keys + index,
+                parent->keys + index + 1,
+                (parent->count - index - 1) * sizeof(struct avl_kv));
+        (void)memmove(
+                parent->u.children + index + 1,
+                parent->u.children + index + 2,
+                (parent->count - index - 1) * sizeof(struct bpt_node*));
+        parent->count -= 1;
+        tree->free(tree->heap, right);
+}
+
+void bpt_borrow_left(
+        struct bpt_node *parent,
+        const size_t index)
+{
+        struct bpt_node *left = parent->u.children[index - 1];
+        struct bpt_node *node = parent->u.children[index];
+        (void)memmove(
+                node->keys + 1,
+                node->keys,
+                node->count * sizeof(struct avl_kv));
+        if(node->leaf) {
+                (void)memmove(
+                        node->u.leaf.values + 1,
+                        node->u.leaf.values,
+                        node->count * sizeof(struct avl_kv));
+                node->keys[0] = left->keys[left->count - 1];
+                node->u.leaf.values[0] = left->u.leaf.values[left->count - 1];
+                parent->keys[index - 1] = node->keys[0];
+        } else {
+                (void)memmove(
+                        node->u.children + 1,
+                        node->u.children,
+                        (node->count + 1) * sizeof(struct bpt_node*));
+                node->keys[0] = parent->keys[index - 1];
+                node->u.children[0] = left->u.children[left->count];
+                parent->keys[index - 1] = left->keys[left->count - 1];
+        }
+        node->count += 1;
+        left->count -= 1;
+}
+
+void bpt_borrow_right(
+        struct bpt_node *parent,
+        const size_t index)
+{
+        struct bpt_node *node = parent->u.children[index];
+        struct bpt_node *right = parent->u.children[index + 1];
+        if(node->leaf) {
+                node->keys[node->count] = right->keys[0];
+                node->u.leaf.values[node->count] = right->u.leaf.values[0];
+                (void)memmove(
+                        right->u.leaf.values,
+                        right->u.leaf.values + 1,
+                        (right->count - 1) * sizeof(struct avl_kv));
+                (void)memmove(
+                        right->keys,
+                        right->keys + 1,
+                        (right->count - 1) * sizeof(struct avl_kv));
+                parent->keys[index] = right->keys[0];
+        } else {
+                node->keys[node->count] = parent->keys[index];
+                node->u.children[node->count + 1] = right->u.children[0];
+                parent->keys[index] = right->keys[0];
+                (void)memmove(
+                        right->keys,
+                        right->keys + 1,
+                        (right->count - 1) * sizeof(struct avl_kv));
+                (void)memmove(
+                        right->u.children,
+                        right->u.children + 1,
+                        right->count * sizeof(struct bpt_node*));
+        }
+        node->count += 1;
+        right->count -= 1;
+}
+
+struct bpt_tree *bpt_remove_at(
+        struct bpt_tree *tree,
+        struct bpt_path *path,
+        struct bpt_node *leaf,
+        const size_t pos,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_node *node = leaf;
+        assert(pos < leaf->count);
+        if(rkey) {
+                *rkey = leaf->keys[pos];
+        }
+        if(rvalue) {
+                *rvalue = leaf->u.leaf.values[pos];
+        }
+        (void)memmove(
+                leaf->keys + pos,
+                leaf->keys + pos + 1,
+                (leaf->count - pos - 1) * sizeof(struct avl_kv));
+        (void)memmove(
+                leaf->u.leaf.values + pos,
+                leaf->u.leaf.values + pos + 1,
+                (leaf->count - pos - 1) * sizeof(struct avl_kv));
+        leaf->count -= 1;
+        tree->size -= 1;
+        for(size_t n = path->size; n > 0 && node->count < BPT_MIN; --n) {
+                struct bpt_node *parent = path->nodes[n - 1];
+                const size_t index = path->index[n - 1];
+                if(index > 0 && parent->u.children[index - 1]->count > BPT_MIN) {
+                        bpt_borrow_left(parent, index);
+                } else if(index < parent->count &&
+                        parent->u.children[index + 1]->count > BPT_MIN)
+                {
+                        bpt_borrow_right(parent, index);
+                } else if(index > 0) {
+                        bpt_merge(tree, parent, index - 1);
+                } else {
+                        bpt_merge(tree, parent, index);
+                }
+                node = parent;
+        }
+        if(!tree->root->leaf && tree->root->count == 0) {
+                node = tree->root;
+                tree->root = node->u.children[0];
+                tree->free(tree->heap, node);
+        } else if(tree->root->leaf && tree->root->count == 0) {
+                tree->free(tree->heap, tree->root);
+                tree->root = NULL;
+        }
+        return tree;
+}
+
+struct bpt_tree *bpt_remove(
+        struct bpt_tree *tree,
+        struct avl_kv key,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_path path;
+        struct bpt_node *leaf;
+        size_t pos;
+        if(!tree->root) {
+                return NULL;
+        }
+        leaf = bpt_descend(tree, &path, key);
+        pos = bpt_rank(tree, leaf, key, 0);
+        if(pos == leaf->count || tree->cmp(key, leaf->keys[pos])) {
+                return NULL;
+        }
+        return bpt_remove_at(tree, &path, leaf, pos, rkey, rvalue);
+}
+
+struct avl_kv *bpt_get(
+        struct bpt_tree *tree,
+        struct avl_kv key)
+{
+        struct bpt_node *node = tree->root;
+        size_t pos;
+        if(!node) {
+                return NULL;
+        }
+        for(size_t I = 0; I < AVL_STACK_MAX && !node->leaf; ++I) {
+                node = node->u.children[bpt_rank(tree, node, key, 1)];
+        }
+        assert(node->leaf);
+        pos = bpt_rank(tree, node, key, 0);
+        if(pos == node->count || tree->cmp(key, node->keys[pos])) {
+                return NULL;
+        }
+        return node->u.leaf.values + pos;
+}
+
+struct bpt_tree *bpt_min(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_cursor cursor;
+        (void)bpt_traverse(tree, &cursor);
+        return bpt_next(&cursor, rkey, rvalue) ? tree : NULL;
+}
+
+struct bpt_tree *bpt_max(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_cursor cursor;
+        (void)bpt_reversed(tree, &cursor);
+        return bpt_prior(&cursor, rkey, rvalue) ? tree : NULL;
+}
+
+struct bpt_tree *bpt_remove_min(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_path path;
+        struct bpt_node *leaf;
+        if(!tree->root) {
+                return NULL;
+        }
+        leaf = bpt_descend_edge(tree, &path, 0);
+        return bpt_remove_at(tree, &path, leaf, 0, rkey, rvalue);
+}
+
+struct bpt_tree *bpt_remove_max(
+        struct bpt_tree *tree,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_path path;
+        struct bpt_node *leaf;
+        if(!tree->root) {
+                return NULL;
+        }
+        leaf = bpt_descend_edge(tree, &path, 1);
+        return bpt_remove_at(tree, &path, leaf, leaf->count - 1, rkey, rvalue);
+}
+
+struct bpt_cursor *bpt_reversed(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor)
+{
+        struct bpt_path path;
+        cursor->leaf = NULL;
+        cursor->index = 0;
+        if(tree->root) {
+                cursor->leaf = bpt_descend_edge(tree, &path, 1);
+                cursor->index = cursor->leaf->count - 1;
+        }
+        return cursor;
+}
+
+struct bpt_cursor *bpt_traverse(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor)
+{
+        struct bpt_path path;
+        cursor->leaf = NULL;
+        cursor->index = 0;
+        if(tree->root) {
+                cursor->leaf = bpt_descend_edge(tree, &path, 0);
+        }
+        return cursor;
+}
+
+int bpt_next(
+        struct bpt_cursor *cursor,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_node *leaf = cursor->leaf;
+        if(!leaf) {
+                return 0;
+        }
+        assert(cursor->index < leaf->count);
+        if(rkey) {
+                *rkey = leaf->keys[cursor->index];
+        }
+        if(rvalue) {
+                *rvalue = leaf->u.leaf.values[cursor->index];
+        }
+        if(++cursor->index == leaf->count) {
+                cursor->leaf = leaf->u.leaf.next;
+                cursor->index = 0;
+        }
+        return 1;
+}
+
+int bpt_prior(
+        struct bpt_cursor *cursor,
+        struct avl_kv *rkey,
+        struct avl_kv *rvalue)
+{
+        struct bpt_node *leaf = cursor->leaf;
+        if(!leaf) {
+                return 0;
+        }
+        assert(cursor->index < leaf->count);
+        if(rkey) {
+                *rkey = leaf->keys[cursor->index];
+        }
+        if(rvalue) {
+                *rvalue = leaf->u.leaf.values[cursor->index];
+        }
+        if(cursor->index == 0) {
+                cursor->leaf = leaf->u.leaf.prev;
+                cursor->index = cursor->leaf ? cursor->leaf->count - 1 : 0;
+        } else {
+                cursor->index -= 1;
+        }
+        return 1;
+}
+
+struct bpt_cursor *bpt_upper(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor,
+        struct avl_kv key)
+{
+        struct bpt_path path;
+        cursor->leaf = NULL;
+        cursor->index = 0;
+        if(!tree->root) {
+                return cursor;
+        }
+        cursor->leaf = bpt_descend(tree, &path, key);
+        cursor->index = bpt_rank(tree, cursor->leaf, key, 0);
+        if(cursor->index == cursor->leaf->count) {
+                cursor->leaf = cursor->leaf->u.leaf.next;
+                cursor->index = 0;
+        }
+        return cursor;
+}
+
+struct bpt_cursor *bpt_lower(
+        struct bpt_tree *tree,
+        struct bpt_cursor *cursor,
+        struct avl_kv key)
+{
+        struct bpt_path path;
+        size_t rank;
+        cursor->leaf = NULL;
+        cursor->index = 0;
+        if(!tree->root) {
+                return cursor;
+        }
+        cursor->leaf = bpt_descend(tree, &path, key);
+        rank = bpt_rank(tree, cursor->leaf, key, 1);
+        if(rank == 0) {
+                cursor->leaf = cursor->leaf->u.leaf.prev;
+                cursor->index = cursor->leaf ? cursor->leaf->count - 1 : 0;
+        } else {
+                cursor->index = rank - 1;
+        }
+        return cursor;
+}
@@ -25,6 +25,11 @@ void free_node(void *heap, struct avl_node *node)
         (void)free(node);
 }
 
+struct avl_node *alloc_str_node(void *heap) 
+{
+        return malloc(sizeof(struct avl_str_node));
+}
+
 int cmp_rand(const void *a, const void *b)
 {
         return (rand() % 3) - 1;
@@ -38,6 +43,37 @@ void init_keys(int64_t *array, const int count)
         (void)qsort(array, (size_t)count, sizeof(int64_t), cmp_rand);
 }
 
+ssize_t check_node(struct avl_node *node)
+{
+        if(!node) {
+                return 0;
+        }
+        const ssize_t hl = check_node(node->left);
+        const ssize_t hr = check_node(node->right);
+        const ssize_t height = node->height & ~AVL_DEAD;
+        AVL_TEST(!node->left || node->left->key.u.i64 < node->key.u.i64);
+        AVL_TEST(!node->right || node->key.u.i64 < node->right->key.u.i64);
+        AVL_TEST(-1 <= hr - hl && hr - hl <= 1);
+        AVL_TEST(height == 1 + (hl < hr ? hr : hl));
+        return height;
+}
+
+ssize_t check_rank(struct avl_node *node)
+{
+        if(!node) {
+                return 0;
+        }
+        const ssize_t rl = check_rank(node->left);
+        const ssize_t rr = check_rank(node->right);
+        const ssize_t rank = node->height & ~AVL_DEAD;
+        AVL_TEST(!node->left || node->left->key.u.i64 < node->key.u.i64);
+        AVL_TEST(!node->right || node->key.u.i64 < node->right->key.u.i64);
+        AVL_TEST(rank - rl == 1 || rank - rl == 2);
+        AVL_TEST(rank - rr == 1 || rank - rr == 2);
+        AVL_TEST(node->left || node->right || rank == 1);
+        return rank;
+}
+
 void add_all(
         struct avl_tree *tree, 
         struct avl_stack *stk, 
@@ -193,6 +229,1065 @@ void test_lower()
         (void)avl_free_nodes(&tree, &stack);
 }
 
+void test_report()
+{
+        (void)puts("test_report()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_report report;
+        size_t total = 0;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        (void)add_all(&tree, &stack, keys, COUNT);
+        AVL_TEST(avl_report(&tree, &stack, &report));
+        AVL_TEST(report.size == COUNT);
+        AVL_TEST(report.height == (size_t)tree.root->height);
+        AVL_TEST(report.bytes == (size_t)COUNT * sizeof(struct avl_node));
+        AVL_TEST(report.depths[0] == 1);
+        for(size_t d = 0; d < AVL_STACK_MAX; ++d) {
+                total += report.depths[d];
+        }
+        AVL_TEST(total == COUNT);
+        (void)avl_free_nodes(&tree, &stack);
+}
+
+#ifdef AVL_STATS
+void test_stats()
+{
+        (void)puts("test_stats()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        (void)add_all(&tree, &stack, keys, COUNT);
+        AVL_TEST(tree.stats.allocs == COUNT);
+        AVL_TEST(avl_rekey(&tree, &stack, avl_max(&tree), AVL_KV(i64, COUNT)));
+        AVL_TEST(tree.stats.allocs == COUNT && tree.stats.frees == 0);
+        AVL_TEST(tree.stats.compares > 0);
+        AVL_TEST(tree.stats.retraces > 0);
+        AVL_TEST(tree.stats.rotations + tree.stats.double_rotations > 0);
+        AVL_TEST(!avl_add(&tree, &stack, AVL_KV(i64, 0), AVL_KV(i64, 0)));
+        AVL_TEST(tree.stats.failed_adds == 1);
+        AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, 0), NULL, NULL));
+        AVL_TEST(tree.stats.frees == 1);
+        (void)avl_stats_reset(&tree);
+        AVL_TEST(tree.stats.compares == 0);
+        (void)avl_free_nodes(&tree, &stack);
+        AVL_TEST(tree.stats.frees == COUNT - 1);
+        AVL_TEST(avl_add(&tree, &stack, AVL_KV(i64, 1), AVL_KV(i64, 1)));
+        AVL_TEST(avl_add(&tree, &stack, AVL_KV(i64, 0), AVL_KV(i64, 0)));
+        AVL_TEST(avl_add(&tree, &stack, AVL_KV(i64, 2), AVL_KV(i64, 2)));
+        AVL_TEST(tree.stats.compares == 3);
+        AVL_TEST(avl_min(&tree)->key.u.i64 == 0);
+        AVL_TEST(avl_max(&tree)->key.u.i64 == 2);
+        (void)avl_free_nodes(&tree, &stack);
+}
+#endif
+
+void test_str()
+{
+        (void)puts("test_str()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        char strs[COUNT][32];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node, *prev = NULL;
+        (void)init_keys(keys, COUNT);
+        (void)avl_str_tree_init(&tree, alloc_str_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        for(int i = 0; i < COUNT; ++i) {
+                (void)sprintf(strs[i], "/path/%i", (int)keys[i]);
+                const size_t len = strlen(strs[i]);
+                AVL_TEST(avl_str_add(
+                        &tree, &stack, strs[i], len, AVL_KV(i64, keys[i])));
+                AVL_TEST(!avl_str_add(
+                        &tree, &stack, strs[i], len, AVL_KV(i64, 0)));
+        }
+        AVL_TEST(!avl_str_get(&tree, "/path", 5));
+        AVL_TEST(!avl_str_get(&tree, "/path/1000", 10));
+        for(int i = 0; i < COUNT; ++i) {
+                node = avl_str_get(&tree, strs[i], strlen(strs[i]));
+                AVL_TEST(node && node->value.u.i64 == keys[i]);
+                AVL_TEST(avl_get(&tree, AVL_KV(ptr, strs[i])) == node);
+        }
+        AVL_TEST(avl_traverse(&tree, &stack));
+        while(avl_next(&stack, &node)) {
+                AVL_TEST(!prev || strcmp(prev->key.u.ptr, node->key.u.ptr) < 0);
+                prev = node;
+        }
+        for(int i = 0; i < COUNT; i += 2) {
+                AVL_TEST(avl_str_remove(
+                        &tree, &stack, strs[i], strlen(strs[i]), NULL, NULL));
+                AVL_TEST(!avl_str_get(&tree, strs[i], strlen(strs[i])));
+                AVL_TEST(avl_str_get(&tree, strs[i + 1], strlen(strs[i + 1])));
+        }
+        AVL_TEST(tree.size == COUNT / 2);
+        node = avl_str_get(&tree, strs[1], strlen(strs[1]));
+        AVL_TEST(avl_rekey(&tree, &stack, node, AVL_KV(ptr, "/rekeyed/1")));
+        AVL_TEST(!avl_str_get(&tree, strs[1], strlen(strs[1])));
+        AVL_TEST(avl_str_get(&tree, "/rekeyed/1", 10) == node);
+        AVL_TEST(avl_str_remove(&tree, &stack, "/rekeyed/1", 10, NULL, NULL));
+        node = avl_add(&tree, &stack, AVL_KV(ptr, "/added/2"), AVL_KV(i64, 2));
+        AVL_TEST(node && ((struct avl_str_node*)node)->length == 8);
+        AVL_TEST(avl_str_get(&tree, "/added/2", 8) == node);
+        AVL_TEST(!avl_str_add(&tree, &stack, "/added/2", 8, AVL_KV(i64, 0)));
+        AVL_TEST(avl_upper(&tree, &stack, AVL_KV(ptr, "/added/")));
+        AVL_TEST(avl_next(&stack, &node) && node->value.u.i64 == 2);
+        AVL_TEST(avl_lower(&tree, &stack, AVL_KV(ptr, "/added/3")));
+        AVL_TEST(avl_prior(&stack, &node) && node->value.u.i64 == 2);
+        AVL_TEST(avl_count(&tree, &stack, AVL_KV(ptr, "/added/2")) == 1);
+        AVL_TEST(avl_count(&tree, &stack, AVL_KV(ptr, "/added/")) == 0);
+        AVL_TEST(avl_remove(
+                &tree, &stack, AVL_KV(ptr, "/added/2"), NULL, NULL));
+        AVL_TEST(!avl_str_get(&tree, "/added/2", 8));
+        (void)avl_free_nodes(&tree, &stack);
+        (void)avl_tree_mode(&tree, AVL_LAZY);
+        AVL_TEST(tree.mode == (AVL_LAZY | AVL_STR));
+}
+
+void test_multi()
+{
+        (void)puts("test_multi()");
+        const int COUNT = 1000;
+        const int DUPS = 4;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(&tree, AVL_MULTI);
+        (void)avl_stack_init(&stack);
+        for(int64_t d = 0; d < DUPS; ++d) {
+                for(int i = 0; i < COUNT; ++i) {
+                        AVL_TEST(avl_add(&tree, &stack, 
+                                AVL_KV(i64, keys[i]), AVL_KV(i64, d)));
+                }
+        }
+        AVL_TEST(tree.size == (size_t)(COUNT * DUPS));
+        AVL_TEST(avl_traverse(&tree, &stack));
+        for(int64_t j = 0; j < COUNT; ++j) {
+                for(int64_t d = 0; d < DUPS; ++d) {
+                        AVL_TEST(avl_next(&stack, &node));
+                        AVL_TEST(node->key.u.i64 == j && node->value.u.i64 == d);
+                }
+        }
+        for(int64_t j = 0; j < COUNT; ++j) {
+                AVL_TEST(avl_count(&tree, &stack, AVL_KV(i64, j)) == DUPS);
+                AVL_TEST(avl_equal_range(&tree, &stack, AVL_KV(i64, j)));
+                AVL_TEST(avl_next(&stack, &node) && avl_next(&stack, &node));
+                AVL_TEST(node->key.u.i64 == j && node->value.u.i64 == 1);
+                AVL_TEST(avl_remove_node(&tree, &stack, node, NULL, NULL));
+                AVL_TEST(avl_count(&tree, &stack, AVL_KV(i64, j)) == DUPS - 1);
+                AVL_TEST(avl_equal_range(&tree, &stack, AVL_KV(i64, j)));
+                for(int64_t d = 0; d < DUPS; ++d) {
+                        if(d == 1) {
+                                continue;
+                        } 
+                        AVL_TEST(avl_next(&stack, &node));
+                        AVL_TEST(node->key.u.i64 == j && node->value.u.i64 == d);
+                }
+        }
+        AVL_TEST(avl_count(&tree, &stack, AVL_KV(i64, COUNT)) == 0);
+        AVL_TEST(avl_equal_range(&tree, &stack, AVL_KV(i64, -1)));
+        AVL_TEST(!avl_next(&stack, &node));
+        (void)avl_free_nodes(&tree, &stack);
+}
+
+void test_remove_node()
+{
+        (void)puts("test_remove_node()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        (void)add_all(&tree, &stack, keys, COUNT);
+        for(int i = 0; i < COUNT; ++i) {
+                node = avl_get(&tree, AVL_KV(i64, keys[i]));
+                AVL_TEST(node);
+                AVL_TEST(avl_remove_node(&tree, &stack, node, NULL, NULL));
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, keys[i])));
+        }
+        AVL_TEST(tree.size == 0 && !tree.root);
+}
+
+void test_lazy()
+{
+        (void)puts("test_lazy()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        struct avl_kv key, value;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(&tree, AVL_LAZY);
+        (void)avl_stack_init(&stack);
+#if !defined(AVL_MERKLE) && !defined(AVL_COUNTS)
+        AVL_TEST(sizeof(struct avl_node) == 2 * sizeof(struct avl_kv) + 
+                2 * sizeof(struct avl_node*) + sizeof(ssize_t));
+#endif
+        (void)add_all(&tree, &stack, keys, COUNT);
+        for(int64_t k = 0; k < COUNT; k += 4) {
+                node = avl_get(&tree, AVL_KV(i64, k));
+                AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, k), &key, NULL));
+                AVL_TEST(key.u.i64 == k);
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)));
+                AVL_TEST(!avl_remove(&tree, &stack, AVL_KV(i64, k), NULL, NULL));
+                AVL_TEST(!k || (node->height & AVL_DEAD));
+        }
+        AVL_TEST(tree.size == COUNT - COUNT / 4 && tree.dead == COUNT / 4 - 1);
+        AVL_TEST(avl_min(&tree)->key.u.i64 == 1);
+        AVL_TEST(avl_add(&tree, &stack, AVL_KV(i64, 8), AVL_KV(i64, -8)));
+        AVL_TEST(avl_get(&tree, AVL_KV(i64, 8))->value.u.i64 == -8);
+        AVL_TEST(tree.dead == COUNT / 4 - 2);
+        AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, 8), NULL, NULL));
+        AVL_TEST(avl_traverse(&tree, &stack));
+        for(int64_t k = 0; k < COUNT; ++k) {
+                if(k % 4) {
+                        AVL_TEST(avl_next(&stack, &node));
+                        AVL_TEST(node->key.u.i64 == k);
+                }
+        }
+        AVL_TEST(!avl_next(&stack, &node));
+        AVL_TEST(avl_remove_min(&tree, &stack, &key, &value));
+        AVL_TEST(key.u.i64 == 1 && tree.dead == COUNT / 4 - 1);
+        AVL_TEST(avl_compact(&tree, &stack));
+        AVL_TEST(tree.dead == 0);
+        AVL_TEST(tree.root->height <= 11);
+        for(int64_t k = 2; k < COUNT; ++k) {
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)) == (k % 4 == 0));
+        }
+        for(int64_t k = 2; k < COUNT; ++k) {
+                if(k % 4) {
+                        AVL_TEST(avl_remove(
+                                &tree, &stack, AVL_KV(i64, k), NULL, NULL));
+                }
+        }
+        AVL_TEST(tree.size == 0 && tree.dead < COUNT / 2);
+        AVL_TEST(!avl_min(&tree) && !avl_max(&tree));
+        (void)avl_free_nodes(&tree, &stack);
+        for(int64_t k = 0; k < COUNT; ++k) {
+                AVL_TEST(avl_add(
+                        &tree, &stack, AVL_KV(i64, k), AVL_KV(i64, k)));
+        }
+        for(int64_t k = 1; k < COUNT; k += 4) {
+                AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, k), NULL, NULL));
+        }
+        AVL_TEST(tree.dead == COUNT / 4);
+        for(int64_t k = 0; k < COUNT / 2; ++k) {
+                if(k % 4 != 1) {
+                        AVL_TEST(avl_remove(
+                                &tree, &stack, AVL_KV(i64, k), NULL, NULL));
+                        AVL_TEST(avl_min(&tree)->key.u.i64 > k);
+                }
+        }
+        AVL_TEST(tree.dead == COUNT / 8);
+        AVL_TEST(avl_min(&tree)->key.u.i64 == COUNT / 2);
+        AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, COUNT - 1), NULL, NULL));
+        AVL_TEST(tree.dead == COUNT / 8);
+        AVL_TEST(avl_max(&tree)->key.u.i64 == COUNT - 2);
+        (void)check_node(tree.root);
+        (void)avl_free_nodes(&tree, &stack);
+}
+
+void test_rekey()
+{
+        (void)puts("test_rekey()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        AVL_TEST(!avl_min(&tree) && !avl_max(&tree));
+        (void)add_all(&tree, &stack, keys, COUNT);
+        for(int64_t i = 0; i < 3 * COUNT; ++i) {
+                node = avl_min(&tree);
+                AVL_TEST(node->key.u.i64 == i);
+                AVL_TEST(avl_rekey(&tree, &stack, node, AVL_KV(i64, i + COUNT)));
+                AVL_TEST(avl_min(&tree)->key.u.i64 == i + 1);
+                AVL_TEST(avl_max(&tree) == node);
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, i + COUNT)) == node);
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, i)));
+        }
+        node = avl_min(&tree);
+        AVL_TEST(!avl_rekey(&tree, &stack, node, avl_max(&tree)->key));
+        AVL_TEST(avl_rekey(&tree, &stack, node, AVL_KV(i64, -1)));
+        AVL_TEST(avl_min(&tree) == node && tree.size == COUNT);
+        (void)avl_free_nodes(&tree, &stack);
+}
+
+void test_retrace()
+{
+        (void)puts("test_retrace()");
+        const int COUNT = 2100;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        for(int i = 0; i < COUNT; ++i) {
+                AVL_TEST(avl_add(&tree, &stack, 
+                        AVL_KV(i64, keys[i]), AVL_KV(i64, 0)));
+                if(i % 3 == 2) {
+                        AVL_TEST(avl_remove(&tree, &stack, 
+                                AVL_KV(i64, keys[i - 1]), NULL, NULL));
+                }
+                (void)check_node(tree.root);
+        }
+        for(int i = 0; i < COUNT; ++i) {
+                if(i % 3 != 1) {
+                        AVL_TEST(avl_remove(&tree, &stack, 
+                                AVL_KV(i64, keys[i]), NULL, NULL));
+                        (void)check_node(tree.root);
+                }
+        }
+        AVL_TEST(tree.size == 0 && !tree.root);
+}
+
+void test_wavl()
+{
+        (void)puts("test_wavl()");
+        const int COUNT = 3000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        struct avl_kv key;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(&tree, AVL_WAVL);
+        (void)avl_stack_init(&stack);
+        for(int i = 0; i < COUNT; ++i) {
+                AVL_TEST(avl_add(&tree, &stack, 
+                        AVL_KV(i64, keys[i]), AVL_KV(i64, 0)));
+                if(i % 3 == 2) {
+                        AVL_TEST(avl_remove(&tree, &stack, 
+                                AVL_KV(i64, keys[i - 1]), NULL, NULL));
+                }
+                (void)check_rank(tree.root);
+        }
+        AVL_TEST(tree.size == 2 * COUNT / 3);
+        AVL_TEST(avl_traverse(&tree, &stack));
+        for(int64_t j = 0, prior = -1; j < 2 * COUNT / 3; ++j) {
+                AVL_TEST(avl_next(&stack, &node));
+                AVL_TEST(prior < node->key.u.i64);
+                prior = node->key.u.i64;
+        }
+        AVL_TEST(!avl_next(&stack, &node));
+        for(int i = 0; i < COUNT; i += 3) {
+                AVL_TEST(avl_remove_min(&tree, &stack, &key, NULL));
+                AVL_TEST(!avl_get(&tree, key));
+                (void)check_rank(tree.root);
+                AVL_TEST(avl_remove_max(&tree, &stack, &key, NULL));
+                AVL_TEST(!avl_get(&tree, key));
+                (void)check_rank(tree.root);
+        }
+        AVL_TEST(tree.size == 0 && !tree.root);
+        (void)add_all(&tree, &stack, keys, COUNT);
+        (void)check_rank(tree.root);
+        for(int i = 0; i < COUNT; ++i) {
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, keys[i])));
+                AVL_TEST(avl_remove(&tree, &stack, 
+                        AVL_KV(i64, keys[i]), NULL, NULL));
+                (void)check_rank(tree.root);
+        }
+        AVL_TEST(tree.size == 0 && !tree.root);
+}
+
+void test_index()
+{
+        (void)puts("test_index()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        struct avl_kv key;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        (void)add_all(&tree, &stack, keys, COUNT / 2);
+        AVL_TEST(avl_tree_index(&tree, &stack, avl_hash_u64));
+        AVL_TEST(tree.index_size >= (size_t)COUNT);
+        for(int i = COUNT / 2; i < COUNT; ++i) {
+                const int64_t k = keys[i];
+                AVL_TEST(avl_add(&tree, &stack,
+                        AVL_KV(i64, k), AVL_KV(i64, k)));
+        }
+        AVL_TEST(!avl_add(&tree, &stack, AVL_KV(i64, 7), AVL_KV(i64, 0)));
+        for(int64_t j = 0; j < COUNT; ++j) {
+                node = avl_get(&tree, AVL_KV(i64, j));
+                AVL_TEST(node && node->key.u.i64 == j && node->value.u.i64 == j);
+        }
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, COUNT)));
+        for(int i = 0; i < COUNT; i += 2) {
+                const int64_t k = keys[i];
+                AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, k), NULL, NULL));
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)));
+        }
+        for(int i = 1; i < COUNT; i += 2) {
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, keys[i])));
+        }
+        node = avl_get(&tree, AVL_KV(i64, keys[1]));
+        AVL_TEST(avl_rekey(&tree, &stack, node, AVL_KV(i64, -1)) == node);
+        AVL_TEST(avl_get(&tree, AVL_KV(i64, -1)) == node);
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, keys[1])));
+        AVL_TEST(avl_remove_min(&tree, &stack, &key, NULL) && key.u.i64 == -1);
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, -1)));
+        AVL_TEST(avl_remove_max(&tree, &stack, &key, NULL));
+        AVL_TEST(!avl_get(&tree, key));
+        (void)avl_free_nodes(&tree, &stack);
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, keys[3])));
+        AVL_TEST(avl_tree_mode(&tree, AVL_LAZY));
+        (void)add_all(&tree, &stack, keys, COUNT);
+        for(int i = 0; i < COUNT; i += 2) {
+                const int64_t k = keys[i];
+                AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, k), NULL, NULL));
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)));
+        }
+        for(int i = 0; i < COUNT; ++i) {
+                const int64_t k = keys[i];
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)) == !(i % 2));
+        }
+        AVL_TEST(avl_add(&tree, &stack, AVL_KV(i64, keys[0]), AVL_KV(i64, 0)));
+        AVL_TEST(avl_get(&tree, AVL_KV(i64, keys[0])));
+        (void)avl_free_nodes(&tree, &stack);
+        AVL_TEST(avl_tree_index(&tree, &stack, NULL) && !tree.index);
+}
+
+size_t compares = 0;
+
+int cmp_i64_counted(struct avl_kv a, struct avl_kv b)
+{
+        compares += 1;
+        return a.u.i64 < b.u.i64;
+}
+
+void test_filter()
+{
+        (void)puts("test_filter()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_kv key;
+        size_t misses = 0;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64_counted, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        AVL_TEST(avl_tree_filter(&tree, &stack, avl_hash_u64));
+        (void)add_all(&tree, &stack, keys, COUNT);
+        AVL_TEST(tree.filter_blocks * 32 >= (size_t)COUNT);
+        for(int64_t j = 0; j < COUNT; ++j) {
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, j)));
+                compares = 0;
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, COUNT + j)));
+                misses += compares ? 0 : 1;
+        }
+        AVL_TEST(misses > COUNT * 9 / 10);
+        for(int i = 0; i < COUNT; i += 2) {
+                const int64_t k = keys[i];
+                AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, k), NULL, NULL));
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)));
+        }
+        AVL_TEST(tree.filter_stale == (size_t)COUNT / 2);
+        AVL_TEST(avl_remove_min(&tree, &stack, &key, NULL));
+        AVL_TEST(tree.filter_stale == 0);
+        compares = 0;
+        AVL_TEST(!avl_get(&tree, key) && !compares);
+        for(int i = 1; i < COUNT; i += 2) {
+                const int64_t k = keys[i];
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)) == (k == key.u.i64));
+        }
+        (void)avl_free_nodes(&tree, &stack);
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, keys[1])));
+        AVL_TEST(avl_tree_filter(&tree, &stack, NULL) && !tree.filter);
+}
+
+void test_cache()
+{
+        (void)puts("test_cache()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64_counted, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        AVL_TEST(avl_tree_cache(&tree, avl_hash_u64, 60));
+        AVL_TEST(tree.cache_size == 64);
+        (void)add_all(&tree, &stack, keys, COUNT);
+        for(int64_t j = 0; j < COUNT; ++j) {
+                node = avl_get(&tree, AVL_KV(i64, j));
+                AVL_TEST(node && node->key.u.i64 == j);
+                compares = 0;
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, j)) == node);
+                AVL_TEST(compares == 2);
+        }
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, COUNT)));
+        for(int i = 0; i < COUNT; i += 2) {
+                const int64_t k = keys[i];
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, k)));
+                AVL_TEST(avl_remove(&tree, &stack, AVL_KV(i64, k), NULL, NULL));
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)));
+        }
+        node = avl_get(&tree, AVL_KV(i64, keys[1]));
+        AVL_TEST(avl_rekey(&tree, &stack, node, AVL_KV(i64, -1)) == node);
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, keys[1])));
+        AVL_TEST(avl_get(&tree, AVL_KV(i64, -1)) == node);
+        (void)avl_free_nodes(&tree, &stack);
+        AVL_TEST(!avl_get(&tree, AVL_KV(i64, keys[3])));
+        AVL_TEST(avl_tree_cache(&tree, NULL, 0) && !tree.cache);
+}
+
+void test_merge()
+{
+        (void)puts("test_merge()");
+        const int64_t COUNT = 300;
+        const int64_t steps[3] = { 2, 3, 5 };
+        struct avl_tree trees[3];
+        struct avl_stack stacks[3];
+        struct avl_merge merge;
+        struct avl_node *node;
+        int64_t prior;
+        size_t source, n;
+        for(size_t t = 0; t < 3; ++t) {
+                (void)avl_tree_init(
+                        &trees[t], cmp_i64, alloc_node, free_node, NULL);
+                (void)avl_stack_init(&stacks[t]);
+                for(int64_t k = 0; k < COUNT; k += steps[t]) {
+                        AVL_TEST(avl_add(&trees[t], &stacks[t], 
+                                AVL_KV(i64, k), AVL_KV(i64, (int64_t)t)));
+                }
+        }
+        (void)avl_merge_init(&merge, AVL_MERGE_ALL, 0);
+        for(size_t t = 0; t < 3; ++t) {
+                AVL_TEST(avl_merge_add(&merge, &trees[t], 
+                        avl_traverse(&trees[t], &stacks[t])));
+        }
+        prior = -1;
+        for(n = 0; avl_merge_next(&merge, &node, &source); ++n) {
+                AVL_TEST(prior <= node->key.u.i64);
+                AVL_TEST(node->value.u.i64 == (int64_t)source);
+                prior = node->key.u.i64;
+        }
+        AVL_TEST(n == 150 + 100 + 60);
+        for(unsigned int policy = 1; policy <= AVL_MERGE_LAST; ++policy) {
+                (void)avl_merge_init(&merge, policy, 0);
+                for(size_t t = 0; t < 3; ++t) {
+                        AVL_TEST(avl_merge_add(&merge, &trees[t], avl_upper(
+                                &trees[t], &stacks[t], AVL_KV(i64, 100))));
+                }
+                for(int64_t k = 100; k < COUNT; ++k) {
+                        int64_t expect = -1;
+                        for(int64_t t = 0; t < 3; ++t) {
+                                if(k % steps[t] == 0 && (expect < 0 || 
+                                        policy == AVL_MERGE_LAST)) 
+                                {
+                                        expect = t;
+                                }
+                        }
+                        if(expect < 0) {
+                                continue;
+                        }
+                        AVL_TEST(avl_merge_next(&merge, &node, &source));
+                        AVL_TEST(node->key.u.i64 == k);
+                        AVL_TEST(node->value.u.i64 == expect);
+                        AVL_TEST((int64_t)source == expect);
+                }
+                AVL_TEST(!avl_merge_next(&merge, &node, NULL));
+        }
+        (void)avl_merge_init(&merge, AVL_MERGE_FIRST, 1);
+        for(size_t t = 0; t < 3; ++t) {
+                AVL_TEST(avl_merge_add(&merge, &trees[t], 
+                        avl_reversed(&trees[t], &stacks[t])));
+        }
+        for(n = 0, prior = COUNT; avl_merge_next(&merge, &node, NULL); ++n) {
+                AVL_TEST(node->key.u.i64 < prior);
+                prior = node->key.u.i64;
+        }
+        AVL_TEST(n == 150 + 100 + 60 - 50 - 30 - 20 + 10);
+        for(size_t t = 0; t < 3; ++t) {
+                (void)avl_free_nodes(&trees[t], &stacks[t]);
+        }
+}
+
+#ifdef AVL_MERKLE
+uint64_t check_merkle(struct avl_node *node)
+{
+        if(!node) {
+                return 0;
+        }
+        const uint64_t merkle = node->digest + 
+                check_merkle(node->left) + check_merkle(node->right);
+        AVL_TEST(node->merkle == merkle);
+        AVL_TEST(!(node->height & AVL_DEAD) || !node->digest);
+        return merkle;
+}
+
+void diff_keys(void *state, struct avl_node *a, struct avl_node *b)
+{
+        int64_t **keys = state;
+        **keys = a ? a->key.u.i64 : b->key.u.i64;
+        *keys += 1;
+}
+
+void test_merkle()
+{
+        (void)puts("test_merkle()");
+        const unsigned int modes[3] = { 0, AVL_WAVL, AVL_LAZY };
+        const int COUNT = 1000;
+        int64_t keys[COUNT], diffs[8], *diff;
+        struct avl_tree a, b;
+        struct avl_stack stack;
+        struct avl_node *node;
+        uint64_t merkle, range;
+        (void)avl_stack_init(&stack);
+        for(size_t m = 0; m < 3; ++m) {
+                (void)avl_tree_init(&a, cmp_i64, alloc_node, free_node, NULL);
+                (void)avl_tree_init(&b, cmp_i64, alloc_node, free_node, NULL);
+                (void)avl_tree_mode(&a, modes[m]);
+                (void)avl_tree_mode(&b, modes[m]);
+                (void)init_keys(keys, COUNT);
+                (void)add_all(&a, &stack, keys, COUNT);
+                (void)init_keys(keys, COUNT);
+                (void)add_all(&b, &stack, keys, COUNT);
+                for(int i = 0; i < COUNT; i += 3) {
+                        AVL_TEST(avl_remove(&a, &stack, 
+                                AVL_KV(i64, keys[i]), NULL, NULL));
+                        AVL_TEST(avl_remove(&b, &stack, 
+                                AVL_KV(i64, keys[i]), NULL, NULL));
+                }
+                AVL_TEST(check_merkle(a.root) == avl_merkle_hash(&a));
+                AVL_TEST(check_merkle(b.root) == avl_merkle_hash(&b));
+                AVL_TEST(avl_merkle_hash(&a) == avl_merkle_hash(&b));
+                AVL_TEST(!avl_merkle_diff(&a, &b, NULL, NULL));
+                merkle = 0;
+                AVL_TEST(avl_upper(&a, &stack, AVL_KV(i64, 100)));
+                while(avl_next(&stack, &node) && node->key.u.i64 <= 200) {
+                        merkle += node->digest;
+                }
+                range = avl_merkle_range(
+                        &a, AVL_KV(i64, 100), AVL_KV(i64, 200));
+                AVL_TEST(merkle == range);
+                AVL_TEST(avl_remove(&b, &stack, 
+                        AVL_KV(i64, keys[1]), NULL, NULL));
+                AVL_TEST(avl_add(&b, &stack, 
+                        AVL_KV(i64, COUNT), AVL_KV(i64, 0)));
+                node = avl_get(&b, AVL_KV(i64, keys[2]));
+                node->value.u.i64 = -1;
+                AVL_TEST(avl_merkle_update(&b, &stack, node));
+                AVL_TEST(check_merkle(b.root) == avl_merkle_hash(&b));
+                AVL_TEST(avl_merkle_hash(&a) != avl_merkle_hash(&b));
+                diff = diffs;
+                AVL_TEST(avl_merkle_diff(&a, &b, diff_keys, &diff) == 3);
+                AVL_TEST(diff == diffs + 3);
+                for(int i = 0; i < 3; ++i) {
+                        AVL_TEST(diffs[i] == keys[1] || diffs[i] == keys[2] ||
+                                diffs[i] == COUNT);
+                }
+                merkle = avl_merkle_hash(&a) - range;
+                AVL_TEST(avl_remove_range(&a, &stack, AVL_KV(i64, 100),
+                        AVL_KV(i64, 200), NULL, NULL));
+                AVL_TEST(check_merkle(a.root) == avl_merkle_hash(&a));
+                AVL_TEST(avl_merkle_hash(&a) == merkle);
+                (void)avl_free_nodes(&a, &stack);
+                (void)avl_free_nodes(&b, &stack);
+        }
+        AVL_TEST(avl_digest_u64(AVL_KV(u64, 0), AVL_KV(u64, 0)));
+        (void)avl_tree_init(&a, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_init(&b, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(&a, AVL_MULTI);
+        (void)avl_tree_mode(&b, AVL_MULTI);
+        for(int64_t i = 0; i < 40; ++i) {
+                AVL_TEST(avl_add(&a, &stack, 
+                        AVL_KV(i64, i % 4), AVL_KV(i64, i)));
+                AVL_TEST(avl_add(&b, &stack, 
+                        AVL_KV(i64, (39 - i) % 4), AVL_KV(i64, 39 - i)));
+        }
+        AVL_TEST(!avl_merkle_diff(&a, &b, NULL, NULL));
+        node = avl_get(&b, AVL_KV(i64, 2));
+        node->value.u.i64 = -1;
+        AVL_TEST(avl_merkle_update(&b, &stack, node));
+        diff = diffs;
+        AVL_TEST(avl_merkle_diff(&a, &b, diff_keys, &diff) == 1);
+        AVL_TEST(diff == diffs + 1 && diffs[0] == 2);
+        (void)avl_free_nodes(&a, &stack);
+        (void)avl_free_nodes(&b, &stack);
+}
+#endif
+
+size_t moves = 0;
+
+void count_move(void *heap, struct avl_node *from, struct avl_node *to)
+{
+        AVL_TEST(from != to && from->key.u.i64 == to->key.u.i64);
+        moves += 1;
+}
+
+double adjacency(struct avl_tree *tree, struct avl_stack *stack)
+{
+        struct avl_node *node;
+        uintptr_t prior = 0;
+        size_t near = 0, pairs = 0;
+        AVL_TEST(avl_traverse(tree, stack));
+        while(avl_next(stack, &node)) {
+                const uintptr_t at = (uintptr_t)node;
+                if(prior) {
+                        near += at > prior &&
+                                at - prior <= 4 * tree->node_size ? 1 : 0;
+                        pairs += 1;
+                }
+                prior = at;
+        }
+        return pairs ? (double)near / (double)pairs : 1.0;
+}
+
+void test_defrag()
+{
+        (void)puts("test_defrag()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        int64_t j;
+        int more = 1;
+        (void)init_keys(keys, COUNT);
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_stack_init(&stack);
+        AVL_TEST(avl_tree_index(&tree, &stack, avl_hash_u64));
+        AVL_TEST(avl_tree_cache(&tree, avl_hash_u64, 64));
+        (void)add_all(&tree, &stack, keys, COUNT);
+        for(j = 0; j < COUNT; ++j) {
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, j)));
+        }
+        for(int i = 0; more; ++i) {
+                more = avl_defrag(&tree, &stack, 64, count_move);
+                AVL_TEST(more >= 0);
+                if(i % 2) {
+                        const int64_t k = keys[i];
+                        AVL_TEST(avl_remove(&tree, &stack, 
+                                AVL_KV(i64, k), NULL, NULL));
+                        AVL_TEST(avl_add(&tree, &stack, 
+                                AVL_KV(i64, k), AVL_KV(i64, k)));
+                }
+                (void)check_node(tree.root);
+        }
+        AVL_TEST(moves >= (size_t)COUNT);
+        AVL_TEST(tree.min->key.u.i64 == 0 && tree.max->key.u.i64 == COUNT - 1);
+        AVL_TEST(avl_traverse(&tree, &stack));
+        for(j = 0; avl_next(&stack, &node); ++j) {
+                AVL_TEST(node->key.u.i64 == j && node->value.u.i64 == j);
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, j)) == node);
+        }
+        AVL_TEST(j == COUNT);
+        moves = 0;
+        AVL_TEST(!avl_defrag(&tree, &stack, (size_t)COUNT + 1, NULL));
+        (void)avl_tree_free(&tree, &stack);
+        AVL_TEST(!tree.root && !tree.index && !tree.cache && !tree.filter);
+        (void)init_keys(keys, COUNT);
+        (void)add_all(&tree, &stack, keys, COUNT);
+        AVL_TEST(adjacency(&tree, &stack) < 0.5);
+        for(more = 1; more; ) {
+                more = avl_defrag(&tree, &stack, 16, NULL);
+                AVL_TEST(more >= 0);
+        }
+        AVL_TEST(adjacency(&tree, &stack) > 0.9);
+        (void)check_node(tree.root);
+        (void)avl_free_nodes(&tree, &stack);
+        (void)avl_tree_mode(&tree, AVL_MULTI);
+        for(int i = 0; i < 11; ++i) {
+                AVL_TEST(avl_add(&tree, &stack,
+                        AVL_KV(i64, i < 10 ? 5 : 9), AVL_KV(i64, i)));
+        }
+        moves = 0;
+        for(more = 1; more; ) {
+                more = avl_defrag(&tree, &stack, 1, count_move);
+                AVL_TEST(more >= 0);
+        }
+        AVL_TEST(moves == 11);
+        AVL_TEST(avl_traverse(&tree, &stack));
+        for(j = 0; avl_next(&stack, &node); ++j) {
+                AVL_TEST(node->value.u.i64 == j);
+        }
+        AVL_TEST(j == 11);
+        (void)avl_free_nodes(&tree, &stack);
+}
+
+void sum_visit(void *state, struct avl_node *node)
+{
+        *(int64_t *)state += node->key.u.i64;
+        (void)free(node);
+}
+
+void check_range(struct avl_tree *tree, struct avl_stack *stack)
+{
+        struct avl_node *node;
+        int64_t j = 0;
+        if(tree->mode & AVL_WAVL) {
+                (void)check_rank(tree->root);
+        } else {
+                (void)check_node(tree->root);
+        }
+        AVL_TEST(avl_traverse(tree, stack));
+        for(size_t n = 0; avl_next(stack, &node); ++n) {
+                AVL_TEST(node->key.u.i64 < 300 || node->key.u.i64 >= 400);
+                AVL_TEST(node->key.u.i64 >= 50 && node->key.u.i64 <= 900);
+                AVL_TEST(avl_get(tree, node->key) == node);
+                AVL_TEST(n || tree->min == node);
+                AVL_TEST(tree->max->key.u.i64 >= node->key.u.i64);
+                j += 1;
+        }
+        AVL_TEST(j == (int64_t)tree->size);
+}
+
+void test_range()
+{
+        (void)puts("test_range()");
+        const int COUNT = 1000;
+        const unsigned int modes[] = {0, AVL_LAZY, AVL_WAVL};
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+                int64_t sum = 0;
+                (void)init_keys(keys, COUNT);
+                (void)avl_tree_init(
+                        &tree, cmp_i64, alloc_node, free_node, NULL);
+                (void)avl_tree_mode(&tree, modes[m]);
+                (void)avl_stack_init(&stack);
+                AVL_TEST(avl_tree_index(&tree, &stack, avl_hash_u64));
+                AVL_TEST(avl_tree_filter(&tree, &stack, avl_hash_u64));
+                AVL_TEST(avl_tree_cache(&tree, avl_hash_u64, 64));
+                (void)add_all(&tree, &stack, keys, COUNT);
+                for(int64_t k = 0; k < COUNT; k += 7) {
+                        AVL_TEST(avl_get(&tree, AVL_KV(i64, k)));
+                        if(k % 2) {
+                                AVL_TEST(avl_remove(&tree, &stack,
+                                        AVL_KV(i64, k), NULL, NULL));
+                        }
+                }
+                const size_t size = tree.size;
+                AVL_TEST(!avl_remove_range(&tree, &stack, AVL_KV(i64, 400),
+                        AVL_KV(i64, 300), NULL, NULL));
+                AVL_TEST(avl_remove_range(&tree, &stack, AVL_KV(i64, 300),
+                        AVL_KV(i64, 399), sum_visit, &sum) == 92);
+                AVL_TEST(sum == 34950 - 7 * 8 * 50);
+                AVL_TEST(!avl_remove_range(&tree, &stack, AVL_KV(i64, 300),
+                        AVL_KV(i64, 399), NULL, NULL));
+                AVL_TEST(avl_truncate_below(&tree, &stack,
+                        AVL_KV(i64, 50), NULL, NULL) == 46);
+                AVL_TEST(avl_truncate_above(&tree, &stack,
+                        AVL_KV(i64, 900), NULL, NULL) == 92);
+                AVL_TEST(tree.size == size - 92 - 46 - 92);
+                AVL_TEST(tree.min->key.u.i64 == 50);
+                AVL_TEST(tree.max->key.u.i64 == 900);
+                for(int64_t k = 0; k < COUNT; ++k) {
+                        AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)) ==
+                                (k < 50 || k > 900 || (k >= 300 && k < 400) ||
+                                (k % 7 == 0 && k % 2)));
+                }
+                (void)check_range(&tree, &stack);
+                const size_t rest = tree.size;
+                AVL_TEST(avl_truncate_above(&tree, &stack,
+                        AVL_KV(i64, -1), NULL, NULL) == rest);
+                AVL_TEST(!tree.root && !tree.min && !tree.max);
+                AVL_TEST(!tree.size && !tree.dead);
+                (void)avl_tree_free(&tree, &stack);
+        }
+}
+
+struct inline_value {
+        int64_t a, b, c, d;
+};
+
+struct avl_node *alloc_inline(void *heap)
+{
+        return malloc(((struct avl_tree *)heap)->node_size);
+}
+
+void test_inline()
+{
+        (void)puts("test_inline()");
+        const int COUNT = 1000;
+        const unsigned int modes[] = {0, AVL_LAZY};
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        struct avl_kv key;
+        struct inline_value value, *slot;
+        for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+                (void)init_keys(keys, COUNT);
+                (void)avl_tree_init(
+                        &tree, cmp_i64, alloc_inline, free_node, &tree);
+                (void)avl_tree_mode(&tree, modes[m]);
+                (void)avl_stack_init(&stack);
+                AVL_TEST(!avl_value(&tree, NULL));
+                AVL_TEST(avl_tree_inline(&tree, sizeof(value)));
+                AVL_TEST(tree.node_size ==
+                        sizeof(struct avl_node) + sizeof(value));
+                for(int i = 0; i < COUNT; ++i) {
+                        const int64_t k = keys[i];
+                        value.a = k;
+                        value.b = value.c = value.d = -k;
+                        AVL_TEST(avl_add_inline(
+                                &tree, &stack, AVL_KV(i64, k), &value));
+                        AVL_TEST(!avl_add_inline(
+                                &tree, &stack, AVL_KV(i64, k), &value));
+                }
+                for(int64_t k = 0; k < COUNT; k += 2) {
+                        AVL_TEST(avl_remove_inline(&tree, &stack,
+                                AVL_KV(i64, k), &key, &value));
+                        AVL_TEST(key.u.i64 == k && value.a == k);
+                        AVL_TEST(value.b == -k && value.d == -k);
+                        AVL_TEST(!avl_remove_inline(&tree, &stack,
+                                AVL_KV(i64, k), NULL, &value));
+                }
+                value.a = value.b = value.c = value.d = 7;
+                AVL_TEST(avl_add_inline(&tree, &stack, AVL_KV(i64, 0), &value));
+                for(int more = 1; more; ) {
+                        more = avl_defrag(&tree, &stack, 64, NULL);
+                        AVL_TEST(more >= 0);
+                }
+                AVL_TEST(avl_traverse(&tree, &stack));
+                while(avl_next(&stack, &node)) {
+                        const int64_t k = node->key.u.i64;
+                        slot = avl_value(&tree, node);
+                        AVL_TEST(slot == (void *)(node + 1));
+                        AVL_TEST(k ? slot->a == k && slot->c == -k :
+                                slot->a == 7 && slot->d == 7);
+                        AVL_TEST(avl_get(&tree, node->key) == node);
+                }
+                AVL_TEST(tree.size == (size_t)COUNT / 2 + 1);
+                (void)avl_free_nodes(&tree, &stack);
+        }
+}
+
+#ifdef AVL_COUNTS
+size_t node_depth(struct avl_tree *tree, int64_t key)
+{
+        struct avl_node *node = tree->root;
+        for(size_t depth = 1; node; ++depth) {
+                if(node->key.u.i64 == key) {
+                        return depth;
+                }
+                node = key < node->key.u.i64 ? node->left : node->right;
+        }
+        return 0;
+}
+
+void test_reshape()
+{
+        (void)puts("test_reshape()");
+        const int COUNT = 1000;
+        const unsigned int modes[] = {
+                AVL_TRACK_HITS, AVL_TRACK_HITS | AVL_LAZY};
+        int64_t keys[COUNT];
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        struct avl_report report;
+        for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+                int64_t j = 0;
+                (void)init_keys(keys, COUNT);
+                (void)avl_tree_init(
+                        &tree, cmp_i64, alloc_node, free_node, NULL);
+                (void)avl_tree_mode(&tree, modes[m]);
+                (void)avl_stack_init(&stack);
+                AVL_TEST(avl_reshape(&tree, &stack));
+                (void)add_all(&tree, &stack, keys, COUNT);
+                AVL_TEST(avl_remove(&tree, &stack,
+                        AVL_KV(i64, 1), NULL, NULL));
+                for(int64_t k = 0; k < COUNT; ++k) {
+                        const int hot = k % 100 == 0 ? 500 : 1;
+                        for(int i = 0; i < hot; ++i) {
+                                AVL_TEST(!avl_get(&tree, AVL_KV(i64, k)) ==
+                                        (k == 1));
+                        }
+                }
+                node = avl_get(&tree, AVL_KV(i64, 100));
+                AVL_TEST(node && node->hits == 501);
+                AVL_TEST(node_depth(&tree, 100) > 3);
+                AVL_TEST(avl_reshape(&tree, &stack));
+                AVL_TEST(tree.shaped && !tree.dead && node->hits == 250);
+                for(int64_t k = 0; k < COUNT; k += 100) {
+                        AVL_TEST(node_depth(&tree, k) <= 5);
+                }
+                AVL_TEST(avl_report(&tree, &stack, &report));
+                AVL_TEST(report.height < AVL_STACK_MAX);
+                AVL_TEST(avl_traverse(&tree, &stack));
+                while(avl_next(&stack, &node)) {
+                        j += j == 1 ? 1 : 0;
+                        AVL_TEST(node->key.u.i64 == j);
+                        AVL_TEST(avl_get(&tree, node->key) == node);
+                        j += 1;
+                }
+                AVL_TEST(j == COUNT && tree.size == (size_t)COUNT - 1);
+                AVL_TEST(tree.min->key.u.i64 == 0);
+                AVL_TEST(tree.max->key.u.i64 == COUNT - 1);
+                AVL_TEST(avl_add(&tree, &stack,
+                        AVL_KV(i64, COUNT), AVL_KV(i64, COUNT)));
+                AVL_TEST(!tree.shaped);
+                (void)check_node(tree.root);
+                AVL_TEST(avl_reshape(&tree, &stack) && tree.shaped);
+                AVL_TEST(avl_remove(&tree, &stack,
+                        AVL_KV(i64, 0), NULL, NULL));
+                AVL_TEST(!avl_get(&tree, AVL_KV(i64, 0)));
+                if(!tree.shaped) {
+                        (void)check_node(tree.root);
+                }
+                (void)avl_free_nodes(&tree, &stack);
+        }
+        (void)avl_tree_init(&tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(&tree, AVL_TRACK_HITS);
+        for(int64_t k = 0; k < 100; ++k) {
+                AVL_TEST(avl_add(&tree, &stack,
+                        AVL_KV(i64, k), AVL_KV(i64, k)));
+        }
+        for(int i = 0; i < 50; ++i) {
+                AVL_TEST(avl_get(&tree, AVL_KV(i64, 90)));
+        }
+        AVL_TEST(avl_reshape(&tree, &stack) && tree.shaped);
+        AVL_TEST(avl_truncate_below(&tree, &stack,
+                AVL_KV(i64, 50), NULL, NULL) == 50);
+        AVL_TEST(tree.size == 50 && !tree.shaped);
+        AVL_TEST(avl_reshape(&tree, &stack) && tree.shaped);
+        AVL_TEST(avl_remove_range(&tree, &stack, AVL_KV(i64, 60),
+                AVL_KV(i64, 69), NULL, NULL) == 10);
+        AVL_TEST(tree.size == 40);
+        (void)check_node(tree.root);
+        AVL_TEST(avl_traverse(&tree, &stack));
+        for(int64_t k = 50; k < 100; ++k) {
+                if(k < 60 || k > 69) {
+                        AVL_TEST(avl_next(&stack, &node));
+                        AVL_TEST(node->key.u.i64 == k);
+                }
+        }
+        AVL_TEST(!avl_next(&stack, &node));
+        (void)avl_free_nodes(&tree, &stack);
+}
+#endif
+
 int main(int argc, char **args) 
 {
         test_add();
@@ -202,5 +1297,29 @@ int main(int argc, char **args)
         test_remove_max();
         test_upper();
         test_lower();
+        test_report();
+        test_str();
+        test_multi();
+        test_remove_node();
+        test_lazy();
+        test_rekey();
+        test_retrace();
+        test_wavl();
+        test_index();
+        test_filter();
+        test_cache();
+        test_merge();
+        test_defrag();
+        test_range();
+        test_inline();
+#ifdef AVL_COUNTS
+        test_reshape();
+#endif
+#ifdef AVL_STATS
+        test_stats();
+#endif
+#ifdef AVL_MERKLE
+        test_merkle();
+#endif
         return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -1,7 +1,13 @@
 
 function shuffle(array) 
 {
-    return array.sort(() => Math.random() - 0.5);
+        for(let n = array.length - 1; n > 0; --n) {
+                const r = Math.floor(Math.random() * (n + 1));
+                const t = array[n];
+                array[n] = array[r];
+                array[r] = t;
+        }
+        return array;
 }
 
 function initKeys(count)
@@ -135,6 +141,249 @@ function testLower()
         }
 }
 
+function testMulti()
+{
+        console.log("testMulti()");
+        const COUNT = 1000;
+        const DUPS = 4;
+        const keys = initKeys(COUNT);
+        const tree = new AVLTree({ multi: true });
+        for(let d = 0; d < DUPS; ++d) {
+                for(let n = 0; n < COUNT; ++n) {
+                        if(!tree.add(keys[n], d)) throw new Error();
+                }
+        }
+        if(tree.size != COUNT * DUPS) throw new Error();
+        const iter = tree[Symbol.iterator]();
+        for(let j = 0; j < COUNT; ++j) {
+                for(let d = 0; d < DUPS; ++d) {
+                        const { value, done } = iter.next();
+                        if(done) throw new Error();
+                        if(value.key != j || value.value != d) throw new Error();
+                }
+        }
+        for(let j = 0; j < COUNT; ++j) {
+                if(tree.count(j) != DUPS) throw new Error();
+                const range = tree.equal(j);
+                range.next();
+                const { value } = range.next();
+                if(value.value != 1) throw new Error();
+                if(!tree.removeNode(value)) throw new Error();
+                let d = 0;
+                for(const node of tree.equal(j)) {
+                        if(d == 1) d += 1;
+                        if(node.key != j || node.value != d) throw new Error();
+                        d += 1;
+                }
+                if(d != DUPS) throw new Error();
+        }
+        if(tree.count(COUNT) != 0) throw new Error();
+        if(tree.size != COUNT * (DUPS - 1)) throw new Error();
+}
+
+function testArray()
+{
+        console.log("testArray()");
+        const COUNT = 1000;
+        const keys = initKeys(COUNT);
+        const tree = new AVLArrayTree({ capacity: 4 });
+        addAll(tree, keys, COUNT);
+        if(tree.size != COUNT || tree.add(7, 0)) throw new Error();
+        if(tree.height[tree.root] > 14) throw new Error();
+        let j = 0;
+        for(const node of tree) {
+                if(tree.key(node) != j || tree.value(node) != j) throw new Error();
+                j += 1;
+        }
+        if(j != COUNT) throw new Error();
+        for(const node of tree.reversed()) {
+                j -= 1;
+                if(tree.key(node) != j) throw new Error();
+        }
+        for(let i = COUNT - 1; i > 0; i -= 7) {
+                const upper = tree.upper(i + 0.5);
+                if(tree.key(upper.next().value) != i + 1 && i + 1 < COUNT) {
+                        throw new Error();
+                }
+                const lower = tree.lower(i - 0.5);
+                if(tree.key(lower.next().value) != i - 1) throw new Error();
+        }
+        for(let i = 0; i < COUNT; i += 7) {
+                let n = 0;
+                for(const node of tree.equal(i)) {
+                        if(tree.key(node) != i) throw new Error();
+                        n += 1;
+                }
+                if(n != 1 || tree.count(i) != 1) throw new Error();
+                for(const node of tree.equal(i + 0.5)) throw new Error();
+        }
+        let thrown = false;
+        try {
+                new AVLArrayTree({ multi: true });
+        } catch(e) {
+                thrown = true;
+        }
+        if(!thrown) throw new Error();
+        const capacity = tree.capacity;
+        const result = { };
+        const last = tree.get(COUNT - 1);
+        if(!tree.removeNode(last, result) || result.key != COUNT - 1) {
+                throw new Error();
+        }
+        if(tree.removeNode(last) || tree.get(COUNT - 1)) throw new Error();
+        if(!tree.add(COUNT - 1, COUNT - 1)) throw new Error();
+        for(let i = 0; i < COUNT; i += 2) {
+                const p = keys[i];
+                if(!tree.remove(p, result) || result.key != p) throw new Error();
+                if(tree.get(p) || tree.remove(p)) throw new Error();
+        }
+        for(let i = 0; i < COUNT; i += 2) {
+                if(!tree.add(keys[i], keys[i])) throw new Error();
+        }
+        if(tree.capacity != capacity) throw new Error();
+        for(let i = 0; i < COUNT / 2; ++i) {
+                if(!tree.removeMin(result) || result.key != i) throw new Error();
+                if(!tree.removeMax(result) || result.key != COUNT - 1 - i) {
+                        throw new Error();
+                }
+        }
+        if(tree.size != 0 || tree.root != 0 || tree.removeMin()) {
+                throw new Error();
+        }
+}
+
+function testShared()
+{
+        console.log("testShared()");
+        const COUNT = 1000;
+        const keys = initKeys(COUNT);
+        const tree = new AVLSharedTree({ capacity: COUNT });
+        const reader = new AVLSharedReader(tree.buffer);
+        addAll(tree, keys, COUNT);
+        if(tree.add(COUNT, COUNT) || reader.size != COUNT) throw new Error();
+        if(Atomics.load(tree.header, AVLSharedTree.VERSION) != 2 * COUNT) {
+                throw new Error();
+        }
+        for(let i = 0; i < COUNT; ++i) {
+                if(reader.get(i) != i) throw new Error();
+        }
+        if(reader.get(-1, null) !== null) throw new Error();
+        const rkeys = new Float64Array(COUNT);
+        const rvalues = new Float64Array(COUNT);
+        if(reader.range(100, 199, rkeys, rvalues) != 100) throw new Error();
+        for(let i = 0; i < 100; ++i) {
+                if(rkeys[i] != 100 + i || rvalues[i] != 100 + i) throw new Error();
+        }
+        for(let i = 0; i < COUNT; i += 2) {
+                if(!tree.remove(keys[i])) throw new Error();
+                if(reader.get(keys[i]) !== undefined) throw new Error();
+        }
+        if(reader.size != COUNT / 2) throw new Error();
+        if(reader.range(-1, COUNT, rkeys, rvalues) != COUNT / 2) {
+                throw new Error();
+        }
+        if(reader.retries != 0) throw new Error();
+}
+
+/** Slots of the control array shared with testSharedThreads' readers */
+const SHARED = { STARTED: 0, STOP: 1, DONE: 2, TORN: 3, READS: 4, RETRIES: 5 };
+
+/** Body of a reader thread for testSharedThreads (even keys never move) */
+function sharedReader(workerData)
+{
+        const control = new Int32Array(workerData.control);
+        const reader = new AVLSharedReader(workerData.buffer);
+        const count = workerData.count;
+        const rkeys = new Float64Array(64);
+        const rvalues = new Float64Array(64);
+        let retries = 0;
+        Atomics.add(control, SHARED.STARTED, 1);
+        for(let n = 0; Atomics.load(control, SHARED.STOP) === 0; ++n) {
+                const key = n % count;
+                const value = reader.get(key);
+                if(key % 2 === 0 ? value !== 2 * key : 
+                        value !== undefined && value !== 2 * key) 
+                {
+                        Atomics.add(control, SHARED.TORN, 1);
+                }
+                const lo = (n * 7) % count;
+                const hi = Math.min(lo + 49, count - 1);
+                const found = reader.range(lo, hi, rkeys, rvalues);
+                let evens = 0;
+                for(let i = 0; i < found; ++i) {
+                        const k = rkeys[i];
+                        if(k < lo || k > hi || rvalues[i] !== 2 * k ||
+                                (i > 0 && k <= rkeys[i - 1])) 
+                        {
+                                Atomics.add(control, SHARED.TORN, 1);
+                        }
+                        evens += k % 2 === 0 ? 1 : 0;
+                }
+                if(evens !== Math.floor(hi / 2) - Math.floor((lo - 1) / 2)) {
+                        Atomics.add(control, SHARED.TORN, 1);
+                }
+                Atomics.add(control, SHARED.READS, 1);
+                Atomics.add(control, SHARED.RETRIES, reader.retries - retries);
+                retries = reader.retries;
+        }
+        Atomics.add(control, SHARED.DONE, 1);
+}
+
+/** Wait until control[index] reaches target, or throw after the deadline. */
+function sharedWait(control, index, target, deadline)
+{
+        for(let value; (value = Atomics.load(control, index)) < target;) {
+                if(Date.now() > deadline) throw new Error();
+                Atomics.wait(control, index, value, 10);
+        }
+}
+
+function testSharedThreads()
+{
+        console.log("testSharedThreads()");
+        const { Worker } = require("worker_threads");
+        const COUNT = 1000;
+        const READERS = 3;
+        const deadline = Date.now() + 30000;
+        const tree = new AVLSharedTree({ capacity: COUNT });
+        const control = new Int32Array(new SharedArrayBuffer(4 * 6));
+        let source = "const { workerData } = require('worker_threads');\n";
+        for(const f of [AVLArrayTree, AVLSharedTree, AVLSharedReader]) {
+                source += f.toString() + "\n";
+        }
+        for(const name of ["VERSION", "ROOT", "SIZE", "CAPACITY", "HEADER"]) {
+                source += `AVLSharedTree.${name} = ${AVLSharedTree[name]};\n`;
+        }
+        source += `const SHARED = ${JSON.stringify(SHARED)};\n`;
+        source += sharedReader.toString() + "\nsharedReader(workerData);\n";
+        for(let k = 0; k < COUNT; ++k) {
+                if(!tree.add(k, 2 * k)) throw new Error();
+        }
+        const workerData = { 
+                buffer: tree.buffer, control: control.buffer, count: COUNT 
+        };
+        for(let n = 0; n < READERS; ++n) {
+                new Worker(source, { eval: true, workerData: workerData });
+        }
+        sharedWait(control, SHARED.STARTED, READERS, deadline);
+        for(let round = 0; round < 50 || 
+                Atomics.load(control, SHARED.RETRIES) === 0; ++round) 
+        {
+                if(Date.now() > deadline) throw new Error();
+                for(let k = 1; k < COUNT; k += 2) {
+                        if(!tree.remove(k)) throw new Error();
+                }
+                for(let k = COUNT - 1; k > 0; k -= 2) {
+                        if(!tree.add(k, 2 * k)) throw new Error();
+                }
+        }
+        Atomics.store(control, SHARED.STOP, 1);
+        sharedWait(control, SHARED.DONE, READERS, deadline);
+        if(Atomics.load(control, SHARED.TORN) !== 0) throw new Error();
+        if(Atomics.load(control, SHARED.READS) === 0) throw new Error();
+        if(tree.size != COUNT) throw new Error();
+}
+
 function testSuite()
 {
         testAdd();
@@ -144,4 +393,8 @@ function testSuite()
         testRemoveMax();
         testUpper();
         testLower();
+        testMulti();
+        testArray();
+        testShared();
+        testSharedThreads();
 }
\ No newline at end of file
@@ -0,0 +1,121 @@
+
+#include "pubavl/avl_par.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define AVL_TEST(expr) if(!(expr)) { \
+        fprintf(stderr, "TEST:%i:%s\r\n", __LINE__, __func__); \
+        abort(); \
+}
+
+int cmp_i64(struct avl_kv a, struct avl_kv b)
+{
+        return a.u.i64 < b.u.i64;
+}
+
+struct avl_node *alloc_node(void *heap)
+{
+        return malloc(sizeof(struct avl_node));
+}
+
+void free_node(void *heap, struct avl_node *node)
+{
+        (void)free(node);
+}
+
+void init_tree(
+        struct avl_tree *tree,
+        struct avl_stack *stack,
+        const unsigned int mode,
+        const int64_t count)
+{
+        (void)avl_tree_init(tree, cmp_i64, alloc_node, free_node, NULL);
+        (void)avl_tree_mode(tree, mode);
+        (void)avl_stack_init(stack);
+        for(int64_t i = 0; i < count; ++i) {
+                const int64_t k = (i * 7919) % count;
+                AVL_TEST(avl_add(tree, stack,
+                        AVL_KV(i64, k), AVL_KV(i64, -k)));
+        }
+        for(int64_t k = 0; k < count; k += 3) {
+                AVL_TEST(avl_remove(tree, stack, AVL_KV(i64, k), NULL, NULL));
+        }
+}
+
+void sum_node(void *local, struct avl_node *node)
+{
+        int64_t *sums = local;
+        sums[0] += 1;
+        sums[1] += node->key.u.i64;
+}
+
+void sum_merge(void *state, void *local)
+{
+        int64_t *total = state, *sums = local;
+        total[0] += sums[0];
+        total[1] += sums[1];
+}
+
+void test_export()
+{
+        (void)puts("test_export()");
+        const int64_t COUNT = 100000;
+        const unsigned int modes[] = {0, AVL_LAZY, AVL_WAVL};
+        struct avl_tree tree;
+        struct avl_stack stack;
+        struct avl_node *node;
+        struct avl_kv *keys = malloc((size_t)COUNT * sizeof(struct avl_kv));
+        struct avl_kv *values = malloc((size_t)COUNT * sizeof(struct avl_kv));
+        AVL_TEST(keys && values);
+        for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+                (void)init_tree(&tree, &stack, modes[m], COUNT);
+                for(size_t threads = 1; threads <= 8; threads *= 2) {
+                        size_t n = 0;
+                        AVL_TEST(avl_par_export(&tree, threads, keys, values));
+                        AVL_TEST(avl_traverse(&tree, &stack));
+                        for(; avl_next(&stack, &node); ++n) {
+                                AVL_TEST(keys[n].u.i64 == node->key.u.i64);
+                                AVL_TEST(values[n].u.i64 == -keys[n].u.i64);
+                        }
+                        AVL_TEST(n == tree.size);
+                }
+                AVL_TEST(avl_par_export(&tree, 4, keys, NULL));
+                AVL_TEST(!avl_par_export(&tree, 0, keys, NULL));
+                (void)avl_free_nodes(&tree, &stack);
+                AVL_TEST(avl_par_export(&tree, 4, keys, values));
+        }
+        (void)free(keys);
+        (void)free(values);
+}
+
+void test_reduce()
+{
+        (void)puts("test_reduce()");
+        const int64_t COUNT = 100000;
+        struct avl_tree tree;
+        struct avl_stack stack;
+        int64_t locals[8][2], total[2], expected = 0;
+        (void)init_tree(&tree, &stack, AVL_LAZY, COUNT);
+        for(int64_t k = 0; k < COUNT; ++k) {
+                expected += k % 3 ? k : 0;
+        }
+        for(size_t threads = 1; threads <= 8; ++threads) {
+                for(size_t n = 0; n < threads; ++n) {
+                        locals[n][0] = locals[n][1] = 0;
+                }
+                total[0] = total[1] = 0;
+                AVL_TEST(avl_par_reduce(&tree, threads, sum_node,
+                        locals, sizeof(locals[0]), sum_merge, total));
+                AVL_TEST(total[0] == (int64_t)tree.size);
+                AVL_TEST(total[1] == expected);
+        }
+        (void)avl_free_nodes(&tree, &stack);
+}
+
+int main(int argc, char **args)
+{
+        test_export();
+        test_reduce();
+        return EXIT_SUCCESS;
+}
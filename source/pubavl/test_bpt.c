@@ -0,0 +1,202 @@
+
+#include "pubavl/bpt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define BPT_TEST(expr) if(!(expr)) { \
+        fprintf(stderr, "TEST:%i:%s\r\n", __LINE__, __func__); \
+        abort(); \
+}
+
+int cmp_i64(struct avl_kv a, struct avl_kv b)
+{
+        return a.u.i64 < b.u.i64;
+}
+
+struct bpt_node *alloc_node(void *heap)
+{
+        return malloc(sizeof(struct bpt_node));
+}
+
+void free_node(void *heap, struct bpt_node *node)
+{
+        (void)free(node);
+}
+
+void init_keys(int64_t *array, const int count)
+{
+        for(int n = 0; n < count; ++n) {
+                array[n] = n;
+        }
+        for(int n = count - 1; n > 0; --n) {
+                const int r = rand() % (n + 1);
+                const int64_t t = array[n];
+                array[n] = array[r];
+                array[r] = t;
+        }
+}
+
+void init_tree(struct bpt_tree *tree, const int i64)
+{
+        if(i64) {
+                (void)bpt_tree_init_i64(tree, alloc_node, free_node, NULL);
+        } else {
+                (void)bpt_tree_init(tree, cmp_i64, alloc_node, free_node, NULL);
+        }
+}
+
+void add_all(struct bpt_tree *tree, int64_t *array, const int count)
+{
+        for(int i = 0; i < count; ++i) {
+                const int64_t r = array[i];
+                BPT_TEST(bpt_add(tree, AVL_KV(i64, r), AVL_KV(i64, r)));
+        }
+}
+
+void test_add(const int i64)
+{
+        (void)puts("test_add()");
+        const int COUNT = 10000;
+        int64_t keys[COUNT];
+        struct bpt_tree tree;
+        struct bpt_cursor cursor;
+        struct avl_kv key, value;
+        (void)init_keys(keys, COUNT);
+        (void)init_tree(&tree, i64);
+        (void)add_all(&tree, keys, COUNT);
+        BPT_TEST(tree.size == COUNT);
+        BPT_TEST(!bpt_add(&tree, AVL_KV(i64, 7), AVL_KV(i64, 0)));
+        BPT_TEST(bpt_traverse(&tree, &cursor));
+        for(int64_t j = 0; j < COUNT; ++j) {
+                BPT_TEST(bpt_next(&cursor, &key, &value));
+                BPT_TEST(key.u.i64 == j && value.u.i64 == j);
+        }
+        BPT_TEST(!bpt_next(&cursor, &key, &value));
+        for(int64_t j = 0; j < COUNT; ++j) {
+                struct avl_kv *slot = bpt_get(&tree, AVL_KV(i64, j));
+                BPT_TEST(slot && slot->u.i64 == j);
+        }
+        BPT_TEST(!bpt_get(&tree, AVL_KV(i64, -1)));
+        BPT_TEST(!bpt_get(&tree, AVL_KV(i64, COUNT)));
+        (void)bpt_free_nodes(&tree);
+}
+
+void test_remove(const int i64)
+{
+        (void)puts("test_remove()");
+        const int COUNT = 10000;
+        int64_t keys[COUNT];
+        struct bpt_tree tree;
+        struct bpt_cursor cursor;
+        struct avl_kv key, value;
+        (void)init_keys(keys, COUNT);
+        (void)init_tree(&tree, i64);
+        (void)add_all(&tree, keys, COUNT);
+        for(int i = 0; i < COUNT; i += 2) {
+                const int64_t k = keys[i];
+                BPT_TEST(bpt_get(&tree, AVL_KV(i64, k)));
+                BPT_TEST(bpt_remove(&tree, AVL_KV(i64, k), &key, &value));
+                BPT_TEST(key.u.i64 == k && value.u.i64 == k);
+                BPT_TEST(!bpt_get(&tree, AVL_KV(i64, k)));
+                BPT_TEST(!bpt_remove(&tree, AVL_KV(i64, k), NULL, NULL));
+        }
+        BPT_TEST(tree.size == COUNT / 2);
+        BPT_TEST(bpt_traverse(&tree, &cursor));
+        for(int i = 0; i < COUNT / 2; ++i) {
+                BPT_TEST(bpt_next(&cursor, &key, &value));
+        }
+        BPT_TEST(!bpt_next(&cursor, &key, &value));
+        for(int i = 1; i < COUNT; i += 2) {
+                BPT_TEST(bpt_remove(&tree, AVL_KV(i64, keys[i]), NULL, NULL));
+        }
+        BPT_TEST(tree.size == 0 && !tree.root);
+}
+
+void test_prior(const int i64)
+{
+        (void)puts("test_prior()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct bpt_tree tree;
+        struct bpt_cursor cursor;
+        struct avl_kv key;
+        (void)init_keys(keys, COUNT);
+        (void)init_tree(&tree, i64);
+        (void)add_all(&tree, keys, COUNT);
+        BPT_TEST(bpt_reversed(&tree, &cursor));
+        for(int64_t j = COUNT - 1; j >= 0; --j) {
+                BPT_TEST(bpt_prior(&cursor, &key, NULL));
+                BPT_TEST(key.u.i64 == j);
+        }
+        BPT_TEST(!bpt_prior(&cursor, &key, NULL));
+        (void)bpt_free_nodes(&tree);
+}
+
+void test_remove_min_max(const int i64)
+{
+        (void)puts("test_remove_min_max()");
+        const int COUNT = 10000;
+        int64_t keys[COUNT];
+        struct bpt_tree tree;
+        struct avl_kv key, value;
+        (void)init_keys(keys, COUNT);
+        (void)init_tree(&tree, i64);
+        (void)add_all(&tree, keys, COUNT);
+        for(int64_t i = 0; i < COUNT / 2; ++i) {
+                BPT_TEST(bpt_min(&tree, &key, &value) && key.u.i64 == i);
+                BPT_TEST(bpt_remove_min(&tree, &key, &value));
+                BPT_TEST(key.u.i64 == i);
+                BPT_TEST(bpt_max(&tree, &key, &value));
+                BPT_TEST(key.u.i64 == COUNT - 1 - i);
+                BPT_TEST(bpt_remove_max(&tree, &key, &value));
+                BPT_TEST(key.u.i64 == COUNT - 1 - i);
+        }
+        BPT_TEST(!bpt_min(&tree, &key, &value));
+        BPT_TEST(!bpt_remove_max(&tree, &key, &value));
+        BPT_TEST(tree.size == 0);
+}
+
+void test_upper_lower(const int i64)
+{
+        (void)puts("test_upper_lower()");
+        const int COUNT = 1000;
+        int64_t keys[COUNT];
+        struct bpt_tree tree;
+        struct bpt_cursor cursor;
+        struct avl_kv key;
+        (void)init_keys(keys, COUNT);
+        (void)init_tree(&tree, i64);
+        for(int i = 0; i < COUNT; ++i) {
+                const int64_t k = 2 * keys[i];
+                BPT_TEST(bpt_add(&tree, AVL_KV(i64, k), AVL_KV(i64, k)));
+        }
+        for(int64_t i = -1; i < 2 * COUNT; ++i) {
+                BPT_TEST(bpt_upper(&tree, &cursor, AVL_KV(i64, i)));
+                for(int64_t j = i + (i < 0 || i % 2 ? 1 : 0); j < 2 * COUNT; j += 2) {
+                        BPT_TEST(bpt_next(&cursor, &key, NULL));
+                        BPT_TEST(key.u.i64 == j);
+                }
+                BPT_TEST(!bpt_next(&cursor, &key, NULL));
+                BPT_TEST(bpt_lower(&tree, &cursor, AVL_KV(i64, i)));
+                for(int64_t j = i - (i < 0 || i % 2 ? 1 : 0); j >= 0; j -= 2) {
+                        BPT_TEST(bpt_prior(&cursor, &key, NULL));
+                        BPT_TEST(key.u.i64 == j);
+                }
+                BPT_TEST(!bpt_prior(&cursor, &key, NULL));
+        }
+        (void)bpt_free_nodes(&tree);
+}
+
+int main(int argc, char **args)
+{
+        for(int i64 = 0; i64 < 2; ++i64) {
+                test_add(i64);
+                test_remove(i64);
+                test_prior(i64);
+                test_remove_min_max(i64);
+                test_upper_lower(i64);
+        }
+        return EXIT_SUCCESS;
+}